@@ -2,6 +2,13 @@
 #include "CppUnitTest.h"
 
 #include <TinyBasic.h>
+#include <TinyBasicLockstep.h>
+#include <TinyBasicMetrics.h>
+#include <TinyBasicScheduler.h>
+#include <TinyBasicServer.h>
+#include <TinyBasicStatic.h>
+
+#include <atomic>
 
 using namespace Microsoft::VisualStudio::CppUnitTestFramework;
 
@@ -84,5 +91,1138 @@ namespace BasicTests
 
 			Assert::AreEqual(vm.variables[0], -1.0);
 		}
+
+		TEST_METHOD(TestMethod7)
+		{
+			BasicTinyBasic<int, OriginalVariables> classic;
+
+			classic.parseLine("10 LET A=7*3");
+			classic.parseLine("20 IF A>21 THEN LET A=0");
+
+			BasicVirtualMachine<int, OriginalVariables> vm;
+			classic.run(vm);
+
+			Assert::AreEqual(vm.variables[0], 21);
+
+			BasicExtendedTinyBasic<float> extended;
+
+			extended.parseLine("10 LET ROOT=SQR(2)");
+
+			BasicVirtualMachine<float, ExtendedVariables> fvm;
+			extended.run(fvm);
+
+			Assert::AreEqual(fvm.variables[0], sqrt(2.0f));
+		}
+
+		TEST_METHOD(TestMethod8)
+		{
+			ExtendedTinyBasic basic;
+
+			basic.functions["TWICE"] = { 1, [](VirtualMachine& vm) { vm[1] = vm[0] * 2; }, true };
+
+			basic.parseLine("10 LET A=TWICE(ABS(0-3))");
+			basic.parseLine("20 LET B=INT(SQR(17))");
+
+			VirtualMachine vm;
+			basic.run(vm);
+
+			Assert::AreEqual(vm.variables[0], 6.0);
+			Assert::AreEqual(vm.variables[1], 4.0);
+		}
+
+		static double scale(void* context, double x)
+		{
+			return *(double*)context * x;
+		}
+
+		TEST_METHOD(TestMethod9)
+		{
+			ExtendedTinyBasic basic;
+
+			double factor = 10;
+			int calls = 0;
+
+			basic.bindFunction("HYPOT", [](double x, double y) { return sqrt(x * x + y * y); });
+			basic.bindFunction("SCALE", &scale, &factor);
+			basic.bindCommand("COUNT", [&calls](double n) { calls += (int)n; });
+
+			basic.parseLine("10 LET A=HYPOT(3,4)");
+			basic.parseLine("20 LET B=SCALE(A)");
+			basic.parseLine("30 COUNT 2");
+			basic.parseLine("40 COUNT 5");
+
+			VirtualMachine vm;
+			basic.run(vm);
+
+			Assert::AreEqual(vm.variables[0], 5.0);
+			Assert::AreEqual(vm.variables[1], 50.0);
+			Assert::AreEqual(calls, 7);
+		}
+
+		TEST_METHOD(TestMethod10)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 DIM A(10), B(2)");
+			basic.parseLine("20 LET I=0");
+			basic.parseLine("30 LET A(I)=I*I");
+			basic.parseLine("40 LET I=I+1");
+			basic.parseLine("50 IF I<11 THEN GOTO 30");
+			basic.parseLine("60 LET S=A(3)+A(10)");
+			basic.parseLine("70 LET B(3)=1");
+			basic.parseLine("80 LET S=0");
+
+			VirtualMachine vm;
+			basic.run(vm);
+
+			Assert::AreEqual(vm.arrays[0][5], 25.0);
+			Assert::AreEqual(vm.variables[1], 109.0);
+		}
+
+		TEST_METHOD(TestMethod11)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 DIM A(100)");
+			basic.parseLine("20 FOR I=0 TO 100");
+			basic.parseLine("30 LET A(I)=(I+1)*2/2-1");
+			basic.parseLine("40 NEXT I");
+			basic.parseLine("50 LET S=0");
+			basic.parseLine("60 FOR J=100 TO 1 STEP -3");
+			basic.parseLine("70 LET S=S+A(J)");
+			basic.parseLine("80 NEXT J");
+			basic.parseLine("90 FOR K=5 TO 1");
+			basic.parseLine("100 LET S=0");
+			basic.parseLine("110 NEXT K");
+
+			VirtualMachine vm;
+			basic.run(vm);
+
+			Assert::AreEqual(vm.arrays[0][100], 100.0);
+			Assert::AreEqual(vm.variables[0], 101.0);
+			Assert::AreEqual(vm.variables[1], 1717.0);
+			Assert::AreEqual(vm.variables[2], -2.0);
+		}
+
+		TEST_METHOD(TestMethod12)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 INPUT N");
+			basic.parseLine("20 LET S=0");
+			basic.parseLine("30 FOR I=1 TO N");
+			basic.parseLine("40 LET S=S+I");
+			basic.parseLine("50 NEXT I");
+			basic.parseLine("60 GOTO 60");
+
+			VirtualMachine vm;
+			basic.load(vm);
+
+			Assert::IsTrue(vm.step(1000) == status::waiting);
+			Assert::IsTrue(vm.step(1000) == status::waiting);
+
+			vm.input(10);
+
+			Assert::IsTrue(vm.step(100000) == status::exhausted);
+			Assert::AreEqual(vm.variables[1], 55.0);
+
+			Assert::IsTrue(vm.runFor(chrono::milliseconds(10)) == status::exhausted);
+
+			basic.parseLine("60 LET A(3)=1");
+			basic.load(vm);
+			vm.input(1);
+
+			Assert::IsTrue(vm.step(100000) == status::error);
+			Assert::IsFalse(vm.error().empty());
+		}
+
+		TEST_METHOD(TestMethod13)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 INPUT A");
+			basic.parseLine("20 FOR I=1 TO 1000");
+			basic.parseLine("30 NEXT I");
+			basic.parseLine("40 INPUT B");
+			basic.parseLine("50 LET C=A*B");
+
+			auto program = basic.compile();
+
+			atomic<int> waiting = 0, finished = 0;
+			atomic<long long> total = 0;
+
+			{
+				Scheduler scheduler(4, 100);
+
+				scheduler.waiting = [&](size_t) { waiting++; };
+				scheduler.finished = [&](size_t, status s, VirtualMachine& vm) { if (s == status::finished) total += (long long)vm.variables[3]; finished++; };
+
+				vector<size_t> sessions;
+				for (int i = 0; i < 1000; i++)
+					sessions.push_back(scheduler.start(program));
+
+				while (waiting < 1000)
+					this_thread::yield();
+
+				for (size_t i = 0; i < sessions.size(); i++)
+				{
+					scheduler.input(sessions[i], (double)i);
+					scheduler.input(sessions[i], 2.0);
+				}
+
+				while (finished < 1000)
+					this_thread::yield();
+
+				Assert::AreEqual(scheduler.active(), (size_t)0);
+			}
+
+			Assert::AreEqual(total.load(), 999LL * 1000);
+		}
+
+		TEST_METHOD(TestMethod14)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 DIM T(3)");
+			basic.parseLine("20 LET S=0");
+			basic.parseLine("30 FOR I=1 TO 100");
+			basic.parseLine("40 GOSUB 100");
+			basic.parseLine("50 NEXT I");
+			basic.parseLine("60 INPUT K");
+			basic.parseLine("70 LET T(1)=S*K");
+			basic.parseLine("80 END");
+			basic.parseLine("100 LET S=S+I");
+			basic.parseLine("110 RETURN");
+
+			VirtualMachine vm;
+			basic.load(vm);
+
+			Assert::IsTrue(vm.step(200) == status::exhausted);
+
+			vector<uint8_t> image = vm.snapshot();
+
+			VirtualMachine restored;
+			basic.load(restored);
+			restored.restore(image);
+
+			VirtualMachine forked = vm.fork();
+
+			Assert::IsTrue(vm.step(100000) == status::waiting);
+			Assert::IsTrue(restored.step(100000) == status::waiting);
+			Assert::IsTrue(forked.step(100000) == status::waiting);
+
+			vm.input(1);
+			restored.input(2);
+			forked.input(3);
+
+			Assert::IsTrue(vm.step(100000) == status::finished);
+			Assert::IsTrue(restored.step(100000) == status::finished);
+			Assert::IsTrue(forked.step(100000) == status::finished);
+
+			Assert::AreEqual(vm.arrays[0][1], 5050.0);
+			Assert::AreEqual(restored.arrays[0][1], 10100.0);
+			Assert::AreEqual(forked.arrays[0][1], 15150.0);
+		}
+		TEST_METHOD(TestMethod15)
+		{
+			ExtendedTinyBasic basic;
+
+			basic.parseLine("10 LET N=A");
+			basic.parseLine("20 LET S=0");
+			basic.parseLine("30 IF N=1 THEN GOTO 90");
+			basic.parseLine("40 LET S=S+1");
+			basic.parseLine("50 LET E=N-INT(N/2)*2");
+			basic.parseLine("60 IF E=0 THEN LET N=N/2");
+			basic.parseLine("70 IF E=1 THEN LET N=3*N+1");
+			basic.parseLine("80 GOTO 30");
+			basic.parseLine("90 LET T=0");
+			basic.parseLine("100 FOR I=1 TO A");
+			basic.parseLine("110 LET T=T+I");
+			basic.parseLine("120 NEXT I");
+
+			auto program = basic.compile();
+
+			vector<VirtualMachine> machines(100), scalar(100);
+			for (size_t i = 0; i < machines.size(); i++)
+			{
+				machines[i].variables[1] = (double)(i + 1);
+				scalar[i].variables[1] = (double)(i + 1);
+			}
+
+			LockstepMachine lockstep;
+			vector<status> results = lockstep.run(program, machines);
+
+			for (size_t i = 0; i < machines.size(); i++)
+			{
+				scalar[i].load(program);
+				Assert::IsTrue(scalar[i].step((size_t)-1) == status::finished);
+				Assert::IsTrue(results[i] == status::finished);
+
+				for (size_t v = 0; v < 8; v++)
+					Assert::AreEqual(machines[i].variables[v], scalar[i].variables[v]);
+			}
+
+			Assert::AreEqual(machines[26].variables[2], 111.0);
+			Assert::IsTrue(lockstep.dispatched > 0);
+		}
+		TEST_METHOD(TestMethod16)
+		{
+			VirtualMachine::Program program;
+
+			program[10].push(instruction::setvar);
+			program[10].push_value((size_t)1000);
+			program[10].push(instruction::push);
+			program[10].push_value(1.0);
+
+			program[20].push(instruction::got);
+			program[20].push_value((size_t)0);
+			program[20].push(instruction::push);
+			program[20].push_value(99.0);
+
+			vector<LoadError> errors = VirtualMachine::verify(program);
+
+			Assert::AreEqual(errors.size(), (size_t)2);
+			Assert::AreEqual(errors[0].line, (size_t)10);
+			Assert::AreEqual(errors[1].line, (size_t)20);
+			Assert::AreEqual(errors[1].message, string("undefined line"));
+
+			VirtualMachine vm;
+			vm.load(program);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::error);
+			Assert::AreEqual(vm.error(), string("line 10: invalid variable"));
+
+			TinyBasic basic;
+
+			basic.parseLine("10 GOSUB 100");
+			basic.parseLine("20 LET A=3");
+			basic.parseLine("30 GOTO A*100");
+			basic.parseLine("100 RETURN");
+
+			Assert::IsTrue(VirtualMachine::verify(*basic.compile()).empty());
+
+			basic.load(vm);
+			Assert::IsTrue(vm.loadErrors().empty());
+			Assert::IsTrue(vm.step((size_t)-1) == status::error);
+			Assert::AreEqual(vm.error(), string("undefined line"));
+		}
+		TEST_METHOD(TestMethod17)
+		{
+			InstructionSet set;
+
+			set.push(instruction::setvar);
+			set.push_value((size_t)300);
+			set.push(instruction::push);
+			set.push_value(2.5);
+			set.push_word(12345);
+
+			Assert::AreEqual(set.size(), (size_t)(1 + 2 + 1 + sizeof(double) + sizeof(size_t)));
+			Assert::AreEqual(set.next(0), (size_t)3);
+			Assert::AreEqual(set.next(3), (size_t)(4 + sizeof(double)));
+
+			size_t at = 1;
+			Assert::AreEqual(set.read(at), (size_t)300);
+			at++;
+			Assert::AreEqual(set.value(at), 2.5);
+			Assert::AreEqual(set.readWord(at), (size_t)12345);
+			Assert::AreEqual(at, set.size());
+
+			TinyBasic basic;
+
+			basic.parseLine("10 LET A=B+C");
+
+			auto program = basic.compile();
+			Assert::AreEqual(program->at(10).size(), (size_t)7);
+		}
+		TEST_METHOD(TestMethod18)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 LET A=3/2");
+			basic.parseLine("20 PRINT \"A=\";A");
+			basic.parseLine("30 PRINT A,2;");
+			basic.parseLine("40 PRINT \"X\"");
+			basic.parseLine("50 PRINT");
+			basic.parseLine("60 PRINT 1/4");
+
+			VirtualMachine vm;
+			basic.load(vm);
+
+			stringstream out;
+			streambuf* console = cout.rdbuf(out.rdbuf());
+			status result = vm.step((size_t)-1);
+			cout.rdbuf(console);
+
+			Assert::IsTrue(result == status::finished);
+			Assert::AreEqual(out.str(), string("A=1.5\n1.5     2X\n\n0.25\n"));
+		}
+		TEST_METHOD(TestMethod19)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 LET S=5");
+			basic.parseLine("20 LET S=1");
+			basic.parseLine("30 LET T=S+1");
+			basic.parseLine("40 GOSUB 100");
+			basic.parseLine("50 LET U=A*2");
+			basic.parseLine("60 END");
+			basic.parseLine("100 LET A=T+1");
+			basic.parseLine("110 LET T=0");
+			basic.parseLine("120 RETURN");
+
+			auto program = basic.compile();
+
+			Assert::AreEqual(program->at(10).size(), (size_t)0);
+			Assert::AreNotEqual(program->at(20).size(), (size_t)0);
+			Assert::AreNotEqual(program->at(100).size(), (size_t)0);
+			Assert::AreNotEqual(program->at(110).size(), (size_t)0);
+
+			VirtualMachine vm;
+			vm.load(program);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.variables[0], 1.0);
+			Assert::AreEqual(vm.variables[1], 0.0);
+			Assert::AreEqual(vm.variables[2], 6.0);
+			Assert::AreEqual(vm.variables[3], 3.0);
+		}
+		TEST_METHOD(TestMethod20)
+		{
+			ExtendedTinyBasic basic;
+
+			basic.parseLine("10 LET K=0");
+			basic.parseLine("20 LET S=0");
+			basic.parseLine("30 LET K=K+1");
+			basic.parseLine("40 IF K>300 THEN GOTO 200");
+			basic.parseLine("50 GOSUB 100+(K-INT(K/4)*4)*10");
+			basic.parseLine("60 GOTO 30");
+			basic.parseLine("100 LET S=S+1");
+			basic.parseLine("105 RETURN");
+			basic.parseLine("110 LET S=S+10");
+			basic.parseLine("115 RETURN");
+			basic.parseLine("120 LET S=S+100");
+			basic.parseLine("125 RETURN");
+			basic.parseLine("130 LET S=S+1000");
+			basic.parseLine("135 RETURN");
+			basic.parseLine("200 GOTO K*1000");
+
+			VirtualMachine vm;
+			basic.load(vm);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::error);
+			Assert::AreEqual(vm.error(), string("undefined line"));
+			Assert::AreEqual(vm.variables[1], 75.0 * 1111);
+		}
+		TEST_METHOD(TestMethod21)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 INPUT N");
+			basic.parseLine("20 GOSUB 100");
+			basic.parseLine("30 PRINT \"N=\";N");
+			basic.parseLine("40 END");
+			basic.parseLine("100 GOSUB 200");
+			basic.parseLine("110 RETURN");
+			basic.parseLine("200 LET N=N*2");
+			basic.parseLine("210 RETURN");
+
+			MetricsAggregator aggregator;
+
+			for (int i = 0; i < 2; i++)
+			{
+				VirtualMachine vm;
+				basic.load(vm);
+				vm.input(21);
+
+				stringstream out;
+				streambuf* console = cout.rdbuf(out.rdbuf());
+				status result = vm.step((size_t)-1);
+				cout.rdbuf(console);
+
+				Assert::IsTrue(result == status::finished);
+
+				Metrics metrics = vm.counters();
+				Assert::AreEqual(metrics.runs, (uint64_t)1);
+				Assert::AreEqual(metrics.instructions, (uint64_t)vm.instructionsExecuted());
+				Assert::AreEqual(metrics.gosub_depth, (uint64_t)2);
+				Assert::AreEqual(metrics.prints, (uint64_t)1);
+				Assert::AreEqual(metrics.print_bytes, (uint64_t)5);
+				Assert::AreEqual(metrics.inputs, (uint64_t)1);
+				Assert::IsTrue(metrics.lines >= 7);
+				Assert::IsTrue(metrics.stack_depth >= 1);
+
+				aggregator.add(vm);
+			}
+
+			string text = aggregator.prometheus();
+			Assert::IsTrue(text.find("# TYPE tinybasic_prints_total counter\ntinybasic_prints_total 2\n") != string::npos);
+			Assert::IsTrue(text.find("tinybasic_gosub_depth_max 2\n") != string::npos);
+			Assert::IsTrue(text.find("tinybasic_machines_total 2\n") != string::npos);
+		}
+		TEST_METHOD(TestMethod22)
+		{
+			Server server("tinybasic-test.sock", 2);
+
+			ServerClient client("tinybasic-test.sock");
+
+			string id = client.submit("10 INPUT N\n20 LET S=N*N\n30 PRINT \"S=\";S\n");
+			Assert::AreEqual(client.submit("10 INPUT N\n20 LET S=N*N\n30 PRINT \"S=\";S\n"), id);
+			Assert::AreEqual(id.size(), (size_t)64); // SHA-256 of the source
+			Assert::AreEqual(server.programs(), (size_t)1);
+
+			string output;
+			string done = client.run(id, 1000, 1000, "7", output);
+			Assert::AreEqual(done.substr(0, 14), string("DONE finished "));
+			Assert::AreEqual(output, string("S=49\nVARIABLE 0 7\nVARIABLE 1 49\n"));
+
+			// the machine of the previous run is reused with nothing left of it
+			done = client.run(id, 1000, 1000, "", output);
+			Assert::AreEqual(done.substr(0, 13), string("DONE waiting "));
+			Assert::AreEqual(output, string());
+
+			string loop = client.submit("10 GOTO 10\n");
+			Assert::AreEqual(client.run(loop, 500, 1000, "", output).substr(0, 15), string("DONE exhausted "));
+			Assert::AreEqual(client.run(loop, (size_t)-1, 20, "", output).substr(0, 13), string("DONE timeout "));
+
+			// one DIM cannot take the memory of the server, the limit holds for all the arrays of a run
+			string big = client.submit("10 DIM A(100000000)\n");
+			Assert::IsTrue(client.run(big, 1000, 1000, "", output).find("DONE error ") == 0);
+			string two = client.submit("10 DIM A(3000000)\n20 DIM B(3000000)\n");
+			Assert::IsTrue(client.run(two, 1000, 1000, "", output).find("array limit exceeded") != string::npos);
+			string one = client.submit("10 DIM A(3000000)\n");
+			Assert::AreEqual(client.run(one, 1000, 1000, "", output).substr(0, 14), string("DONE finished "));
+
+			bool rejected = false;
+			try
+			{
+				client.submit("PRINT 1\n");
+			}
+			catch (const runtime_error&)
+			{
+				rejected = true;
+			}
+			Assert::IsTrue(rejected);
+
+			LoadReport report = generateLoad("tinybasic-test.sock", "10 FOR I=1 TO 100\n20 LET S=S+I\n30 NEXT I\n", 4, 25);
+			Assert::AreEqual(report.requests, (size_t)100);
+			Assert::AreEqual(report.failures, (size_t)0);
+			Assert::IsTrue(report.p99 >= report.p50);
+		}
+		TEST_METHOD(TestMethod23)
+		{
+			TinyBasic basic;
+
+			basic.parseLine("10 DIM A(1000)");
+			basic.parseLine("20 LET S=5");
+			basic.parseLine("30 LET M=0");
+			basic.parseLine("40 PARALLEL FOR I=0 TO 1000 SUM S MAX M");
+			basic.parseLine("50 LET A(I)=I*2");
+			basic.parseLine("60 LET S=S+I");
+			basic.parseLine("70 IF A(I)>M THEN LET M=A(I)");
+			basic.parseLine("80 NEXT I");
+			basic.parseLine("90 LET T=S+M");
+
+			VirtualMachine vm;
+			basic.load(vm);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.variables[0], 500505.0);
+			Assert::AreEqual(vm.variables[1], 2000.0);
+			Assert::AreEqual(vm.variables[2], 1001.0);
+			Assert::AreEqual(vm.arrays[0][777], 1554.0);
+
+			// the body runs on other threads, it cannot leave the loop or talk to the host
+			size_t calls = 0;
+			basic.bindFunction("F", [&](double x) { calls++; return x; });
+			basic.bindCommand("COUNT", [&]() { calls++; });
+
+			const char* bodies[] = { "60 PRINT I", "60 INPUT X", "60 IF I=3 THEN GOTO 90", "60 LET X=F(I)", "60 COUNT" };
+			const char* errors[] = { "PRINT in PARALLEL FOR", "INPUT in PARALLEL FOR", "GOTO out of PARALLEL FOR", "host callable in PARALLEL FOR", "host callable in PARALLEL FOR" };
+
+			for (size_t b = 0; b < 5; b++)
+			{
+				basic.parseLine(bodies[b]);
+				basic.load(vm);
+
+				Assert::IsTrue(vm.step((size_t)-1) == status::error);
+				Assert::AreEqual(vm.loadErrors()[0].message, string(errors[b]));
+				Assert::AreEqual(vm.loadErrors()[0].line, (size_t)60);
+			}
+			Assert::AreEqual(calls, (size_t)0);
+		}
+		TEST_METHOD(TestMethod24)
+		{
+			ExtendedTinyBasic basic;
+
+			basic.parseLine("10 DIM A(100), B(100), C(100)");
+			basic.parseLine("20 FOR I=0 TO 100");
+			basic.parseLine("30 LET A(I)=I");
+			basic.parseLine("40 LET B(I)=2");
+			basic.parseLine("50 NEXT I");
+			basic.parseLine("60 MAT C = A + B");
+			basic.parseLine("70 MAT C = C * 3");
+			basic.parseLine("80 MAT B = 1 - A");
+			basic.parseLine("90 MAT A = SQR(A)");
+			basic.parseLine("100 LET S = SUM(C)");
+			basic.parseLine("110 LET D = DOT(C, B)");
+			basic.parseLine("120 MAT B = (S/2)");
+
+			VirtualMachine vm;
+			basic.load(vm);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.arrays[0][16], 4.0);
+			Assert::AreEqual(vm.arrays[2][99], 303.0);
+			Assert::AreEqual(vm.arrays[1][100], 7878.0);
+			Assert::AreEqual(vm.variables[1], 15756.0);
+			Assert::AreEqual(vm.variables[2], -1029594.0);
+
+			basic.parseLine("120 MAT B = A + Z");
+			basic.load(vm);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::error);
+			Assert::AreEqual(vm.error(), string("MAT arrays of different sizes"));
+		}
+		TEST_METHOD(TestMethod25)
+		{
+			SpscChannel<number> spsc(3);
+			for (int i = 0; i < 4; i++)
+				Assert::IsTrue(spsc.trySend(i));
+			Assert::IsFalse(spsc.trySend(4));
+
+			number value;
+			Assert::IsTrue(spsc.tryReceive(value));
+			Assert::AreEqual(value, (number)0);
+
+			// two producers and a consumer connected by a small channel, each one on its own thread
+			TinyBasic producer;
+			producer.parseLine("10 FOR I=1 TO 1000");
+			producer.parseLine("20 SEND 0, I");
+			producer.parseLine("30 NEXT I");
+			producer.parseLine("40 SEND 0, -1");
+
+			TinyBasic consumer;
+			consumer.parseLine("10 RECV 0, X");
+			consumer.parseLine("20 IF X<0 THEN LET E=E+1");
+			consumer.parseLine("30 IF X>0 THEN LET S=S+X");
+			consumer.parseLine("40 IF E<2 THEN GOTO 10");
+
+			shared_ptr<Channel<number>> channel = make_shared<MpmcChannel<number>>(8);
+
+			VirtualMachine vms[3];
+			producer.load(vms[0]);
+			producer.load(vms[1]);
+			consumer.load(vms[2]);
+
+			vector<thread> threads;
+			for (VirtualMachine& vm : vms)
+			{
+				vm.bind(0, channel);
+				threads.emplace_back([&vm]
+				{
+					status s;
+					while ((s = vm.step(1000)) == status::exhausted || s == status::blocked)
+						this_thread::yield();
+				});
+			}
+
+			for (thread& t : threads)
+				t.join();
+
+			Assert::AreEqual(vms[2].variables[2], 1001000.0);
+
+			// a machine without the channel stops
+			VirtualMachine alone;
+			consumer.load(alone);
+			Assert::IsTrue(alone.step((size_t)-1) == status::error);
+			Assert::AreEqual(alone.error(), string("unbound channel"));
+		}
+		TEST_METHOD(TestMethod26)
+		{
+			// the builtin tables are shared, an extension stays in the parser it was added to
+			ExtendedTinyBasic extended;
+			extended.commands["HALVE"] = { 0, [](VirtualMachine& vm) { vm.variables[0] /= 2; }, false };
+
+			extended.parseLine("10 LET A=SQR(16)+PI-PI");
+			extended.parseLine("20 HALVE");
+			extended.parseLine("30 CLEAR");
+			extended.parseLine("40 LET B=ABS(0-A)");
+
+			VirtualMachine vm;
+			extended.run(vm);
+			Assert::AreEqual(vm.variables[1], 0.0);
+
+			// a line that does not parse is not kept
+			ExtendedTinyBasic other;
+			other.parseLine("10 LET A=SQR(16)");
+			other.parseLine("20 HALVE");
+
+			VirtualMachine ovm;
+			other.run(ovm);
+			Assert::AreEqual(ovm.variables[0], 4.0);
+
+			// the statements are known to every parser, the commands of a dialect only to its parsers
+			TinyBasic basic;
+			basic.parseLine("10 LET A=1");
+			basic.parseLine("20 CLEAR");
+
+			VirtualMachine bvm;
+			basic.run(bvm);
+			Assert::AreEqual(bvm.variables[0], 1.0);
+		}
+		TEST_METHOD(TestMethod27)
+		{
+			// parsed by the C++ compiler, a syntax error would not compile
+			static constexpr auto program = StaticTinyBasic::compile(
+				"10 FOR I=1 TO 10\n"
+				"20 GOSUB 100\n"
+				"30 NEXT I\n"
+				"40 IF S>=100 THEN PRINT \"SUM \";S\n"
+				"50 END\n"
+				"100 LET S=S+I*2-1\n"
+				"110 RETURN\n");
+
+			static_assert(program.line_count == 7, "every line is compiled");
+
+			ostringstream out;
+			VirtualMachine vm;
+			vm.redirect(out);
+			vm.load(program.program());
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.variables[1], 100.0);
+
+			// the runtime parser gives the same program
+			TinyBasic basic;
+			basic.parseLine("10 FOR I=1 TO 10");
+			basic.parseLine("20 GOSUB 100");
+			basic.parseLine("30 NEXT I");
+			basic.parseLine("40 IF S>=100 THEN PRINT \"SUM \";S");
+			basic.parseLine("50 END");
+			basic.parseLine("100 LET S=S+I*2-1");
+			basic.parseLine("110 RETURN");
+
+			ostringstream parsedOut;
+			VirtualMachine parsed;
+			parsed.redirect(parsedOut);
+			basic.load(parsed);
+
+			Assert::IsTrue(parsed.step((size_t)-1) == status::finished);
+			Assert::AreEqual(parsed.variables[1], vm.variables[1]);
+			Assert::AreEqual(out.str(), parsedOut.str());
+			Assert::AreEqual(out.str(), string("SUM 100\n"));
+		}
+		TEST_METHOD(TestMethod28)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 LET K=3");
+			basic.parseLine("20 LET X=0");
+			basic.parseLine("30 LET Y=SQR(K*K+16)*X");
+			basic.parseLine("40 LET S=S+Y");
+			basic.parseLine("50 LET X=X+1");
+			basic.parseLine("60 IF X<100 THEN GOTO 30");
+			basic.parseLine("70 LET J=0");
+			basic.parseLine("80 LET A=A+J*4");
+			basic.parseLine("90 LET B=B+J*4");
+			basic.parseLine("100 LET C=C+J*4");
+			basic.parseLine("110 LET J=J+2");
+			basic.parseLine("120 IF J<100 THEN GOTO 80");
+
+			// SQR(K*K+16) is computed once before each loop on a new line, J*4 grows with J
+			shared_ptr<const VirtualMachine::Program> program = basic.compile();
+			Assert::IsTrue(program->count(29) == 1);
+			Assert::IsTrue(program->count(79) == 1);
+
+			VirtualMachine vm;
+			vm.load(program);
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.variables[3], 5.0 * 4950);
+			Assert::AreEqual(vm.variables[5], 4.0 * 2450);
+			Assert::AreEqual(vm.variables[7], 4.0 * 2450);
+
+			// the hoisted values are kept out of the variables the program does not name
+			for (size_t v = 8; v < Variables::size; v++)
+				Assert::AreEqual(vm.variables[v], 0.0);
+
+			// a loop entered by a jump to its header is left alone
+			basic.parseLine("25 GOTO 30");
+			Assert::IsTrue(basic.compile()->count(29) == 0);
+		}
+		TEST_METHOD(TestMethod29)
+		{
+			ExtendedTinyBasic basic;
+			basic.functions["TWICE"] = { 1, [](VirtualMachine& vm) { vm[1] = vm[0] * 2; }, true };
+
+			basic.parseLine("10 LET X=X+1");
+			basic.parseLine("20 LET Y=SQR(X)+TWICE(X)");
+			basic.parseLine("30 IF X<10 THEN GOTO 10");
+
+			VirtualMachine vm;
+			vm.profile(true);
+			vm.load(basic.compile());
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.profiles().at(20).runs, (uint64_t)10);
+			Assert::AreEqual(vm.profiles().at(20).instructions, (uint64_t)60);
+
+			// names in place of numbers and addresses, and what the line cost
+			string code = basic.explain(20, vm.profiles());
+			Assert::IsTrue(code.find("20 LET Y=SQR(X)+TWICE(X)") == 0);
+			Assert::IsTrue(code.find("setvar Y") != string::npos);
+			Assert::IsTrue(code.find("SQR") != string::npos);
+			Assert::IsTrue(code.find("call TWICE") != string::npos);
+			Assert::IsTrue(code.find("cost: 6 instructions, ran 10 times, 60 dispatched") != string::npos);
+
+			// the same from the console
+			stringstream out;
+			streambuf* console = cout.rdbuf(out.rdbuf());
+			basic.parseLine("LIST CODE");
+			basic.parseLine("EXPLAIN 30");
+			cout.rdbuf(console);
+
+			Assert::IsTrue(out.str().find("10 LET X=X+1\n    setvar X\n      plus\n        getvar X\n        push 1\n    cost: 4 instructions\n") != string::npos);
+			Assert::IsTrue(out.str().find("30 IF X<10 THEN GOTO 10\n    lt\n") != string::npos);
+
+			// a plain RUN keeps the static costs, RUN PROFILE adds what each line took
+			out.str("");
+			console = cout.rdbuf(out.rdbuf());
+			basic.parseLine("RUN");
+			basic.parseLine("EXPLAIN 10");
+			basic.parseLine("RUN PROFILE");
+			basic.parseLine("EXPLAIN 10");
+			cout.rdbuf(console);
+
+			Assert::IsTrue(out.str().find("    cost: 4 instructions\n") != string::npos);
+			Assert::IsTrue(out.str().find("    cost: 4 instructions, ran 10 times, 40 dispatched") != string::npos);
+		}
+		TEST_METHOD(TestMethod30)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 DATA 1.5, -2");
+			basic.parseLine("20 DATA 3, 4, 5");
+			basic.parseLine("30 READ A, B");
+			basic.parseLine("40 DIM T(2)");
+			basic.parseLine("50 MAT READ T");
+			basic.parseLine("60 RESTORE 20");
+			basic.parseLine("70 READ C");
+			basic.parseLine("80 RESTORE");
+			basic.parseLine("90 READ D");
+			basic.parseLine("100 MAT READ T");
+			basic.parseLine("110 READ E");
+			basic.parseLine("120 READ F");
+
+			// one segment before the first line, the DATA lines are empty
+			shared_ptr<const VirtualMachine::Program> program = basic.compile();
+			Assert::IsTrue(program->at(10).size() == 0);
+			Assert::IsTrue(basic.explain(0).find("data 5 values") != string::npos);
+
+			// each machine has its own position in the shared values
+			VirtualMachine first, second;
+			first.load(program);
+			second.load(program);
+
+			Assert::IsTrue(first.step((size_t)-1) == status::error);
+			Assert::AreEqual(first.error(), string("out of DATA"));
+			Assert::IsTrue(second.step(8) == status::exhausted);
+
+			Assert::AreEqual(first.variables[0], 1.5);
+			Assert::AreEqual(first.variables[1], -2.0);
+			Assert::AreEqual(first.variables[2], 3.0);
+			Assert::AreEqual(first.variables[3], 1.5);
+			Assert::AreEqual(first.variables[4], 5.0);
+			Assert::AreEqual(first.arrays[0][0], -2.0);
+			Assert::AreEqual(first.arrays[0][2], 4.0);
+
+			Assert::AreEqual(second.variables[0], 1.5);
+			Assert::AreEqual(second.arrays[0][2], 5.0);
+
+			// a sign before a positive number, no value that is not finite
+			ExtendedTinyBasic signs;
+			signs.parseLine("10 DATA +2.5, -1, +3");
+			signs.parseLine("20 DATA INF");
+			signs.parseLine("30 DATA 1, nan");
+			signs.parseLine("40 DATA +-1");
+			signs.parseLine("50 READ A, B, C");
+
+			program = signs.compile();
+			Assert::IsTrue(program->count(10) == 1);
+			Assert::IsTrue(program->count(20) == 0);
+			Assert::IsTrue(program->count(30) == 0);
+			Assert::IsTrue(program->count(40) == 0);
+
+			VirtualMachine vm;
+			vm.load(program);
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::AreEqual(vm.variables[0], 2.5);
+			Assert::AreEqual(vm.variables[1], -1.0);
+			Assert::AreEqual(vm.variables[2], 3.0);
+		}
+		TEST_METHOD(TestMethod31)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 DIM A(10)");
+			basic.parseLine("20 FOR I=0 TO 10");
+			basic.parseLine("30 LET A(I)=I*I+SQR(I)");
+			basic.parseLine("40 NEXT I");
+			basic.parseLine("50 FOR I=0 TO 10");
+			basic.parseLine("60 LET S=S+A(I)*(2-I*(1+I))");
+			basic.parseLine("70 IF S<-100 THEN PRINT S");
+			basic.parseLine("80 NEXT I");
+
+			shared_ptr<const VirtualMachine::Program> program = basic.compile();
+
+			ostringstream stackOut, cachedOut;
+			VirtualMachine stacked, cached;
+			stacked.redirect(stackOut);
+			cached.redirect(cachedOut);
+			cached.cacheOperands(true);
+
+			stacked.load(program);
+			cached.load(program);
+			Assert::IsTrue(stacked.step((size_t)-1) == status::finished);
+			Assert::IsTrue(cached.step((size_t)-1) == status::finished);
+
+			// the same run, with only the operands of FOR and IF left on the stack
+			Assert::AreEqual(cached.variables[1], stacked.variables[1]);
+			Assert::AreEqual(cached.arrays[0][10], stacked.arrays[0][10]);
+			Assert::AreEqual(cachedOut.str(), stackOut.str());
+			Assert::AreEqual(cached.instructionsExecuted(), stacked.instructionsExecuted());
+			Assert::AreEqual(stacked.counters().stack_depth, (uint64_t)6);
+			Assert::AreEqual(cached.counters().stack_depth, (uint64_t)3);
+		}
+		TEST_METHOD(TestMethod32)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 INPUT N");
+			basic.parseLine("20 DIM A(N)");
+			basic.parseLine("30 LET A(5)=1");
+
+			// sizes whose bytes cannot be counted stop the machine before anything is allocated
+			for (double size : { 2305843009213693952.0, numeric_limits<double>::infinity(), numeric_limits<double>::quiet_NaN() })
+			{
+				VirtualMachine vm;
+				basic.load(vm);
+				vm.input(size);
+
+				Assert::IsTrue(vm.step((size_t)-1) == status::error);
+				Assert::AreEqual(vm.error(), string("array too large"));
+			}
+
+			bool rejected = false;
+			try
+			{
+				aligned_array<double> a;
+				a.resize((size_t)1 << 61);
+			}
+			catch (const bad_alloc&)
+			{
+				rejected = true;
+			}
+			Assert::IsTrue(rejected);
+
+			// an array never given a size stops the machine, with either engine
+			ExtendedTinyBasic undimmed;
+			undimmed.parseLine("10 LET X=A(2)");
+			for (bool cached : { false, true })
+			{
+				VirtualMachine vm;
+				vm.cacheOperands(cached);
+				undimmed.load(vm);
+
+				Assert::IsTrue(vm.step((size_t)-1) == status::error);
+				Assert::AreEqual(vm.error(), string("array index out of bounds"));
+			}
+		}
+		TEST_METHOD(TestMethod33)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 DIM T(3)");
+			basic.parseLine("20 FOR I=1 TO 100");
+			basic.parseLine("30 LET T(1)=T(1)+I");
+			basic.parseLine("40 NEXT I");
+
+			VirtualMachine vm;
+			basic.load(vm);
+			Assert::IsTrue(vm.step(50) == status::exhausted);
+			vector<uint8_t> image = vm.snapshot();
+
+			VirtualMachine target;
+			basic.load(target);
+			target.variables[0] = 7;
+
+			auto rejected = [&](const vector<uint8_t>& bad)
+			{
+				try
+				{
+					target.restore(bad);
+				}
+				catch (const invalid_argument&)
+				{
+					return target.variables[0] == 7 && target.arrays.empty();
+				}
+				return false;
+			};
+
+			// a cut image is rejected without touching the machine
+			for (size_t n = 0; n < image.size(); n++)
+				Assert::IsTrue(rejected(vector<uint8_t>(image.begin(), image.begin() + n)));
+
+			// sizes past what the image holds, a loop on a variable that does not exist
+			vector<uint8_t> header(image.begin(), image.begin() + 5);
+			vector<uint8_t> huge = header;
+			huge.insert(huge.end(), { 0, 0, 1, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x20 });
+			Assert::IsTrue(rejected(huge));
+
+			vector<uint8_t> loop = header;
+			loop.insert(loop.end(), { 0, 0, 0, 0, 0, 1, 0xff, 0x7f });
+			loop.insert(loop.end(), 2 * sizeof(double) + 2, 0);
+			Assert::IsTrue(rejected(loop));
+
+			target.restore(image);
+			Assert::IsTrue(target.step((size_t)-1) == status::finished);
+			Assert::AreEqual(target.arrays[0][1], 5050.0);
+		}
+		TEST_METHOD(TestMethod34)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 INPUT N");
+			basic.parseLine("20 DIM A(N)");
+			basic.parseLine("30 PRINT N");
+
+			// the program is verified and runs without exception handling, the failed allocation still only stops it
+			VirtualMachine vm;
+			basic.load(vm);
+			vm.input(1E15);
+
+			Assert::IsTrue(vm.step((size_t)-1) == status::error);
+			Assert::AreEqual(vm.error(), string("out of memory"));
+
+			// a limit given by the host stops it before anything is allocated
+			VirtualMachine limited;
+			limited.limitArrays(10);
+			basic.load(limited);
+			limited.input(10);
+			Assert::IsTrue(limited.step((size_t)-1) == status::error);
+			Assert::AreEqual(limited.error(), string("array limit exceeded"));
+			Assert::IsTrue(limited.arrays.empty());
+		}
+		TEST_METHOD(TestMethod35)
+		{
+			size_t calls = 0;
+			ExtendedTinyBasic basic;
+			basic.bindFunction("F", [&](double x) { calls++; return x; });
+			basic.parseLine("10 SEND 0, F(7)");
+			basic.parseLine("20 LET A=1");
+
+			shared_ptr<Channel<number>> channel = make_shared<SpscChannel<number>>(1);
+			Assert::IsTrue(channel->trySend(0));
+
+			// the value is computed once, a full channel is only tried again
+			VirtualMachine vm;
+			basic.load(vm);
+			vm.bind(0, channel);
+			for (int i = 0; i < 3; i++)
+				Assert::IsTrue(vm.step((size_t)-1) == status::blocked);
+			Assert::AreEqual(calls, (size_t)1);
+
+			number value;
+			Assert::IsTrue(channel->tryReceive(value));
+			Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+			Assert::IsTrue(channel->tryReceive(value));
+			Assert::AreEqual(value, 7.0);
+			Assert::AreEqual(calls, (size_t)1);
+			Assert::AreEqual(vm.variables[0], 1.0);
+		}
+		TEST_METHOD(TestMethod36)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 DIM A(10)");
+			basic.parseLine("20 FOR I=0 TO 10");
+			basic.parseLine("30 LET A(I)=I");
+			basic.parseLine("40 IF A(I)<5 THEN LET B=B+A(I)");
+			basic.parseLine("50 NEXT I");
+
+			shared_ptr<const VirtualMachine::Program> program = basic.compile();
+			auto restored = [&](const vector<uint8_t>& image)
+			{
+				VirtualMachine target;
+				target.load(program);
+				try
+				{
+					target.restore(image);
+				}
+				catch (const invalid_argument&)
+				{
+					return false;
+				}
+				return target.step((size_t)-1) == status::finished && target.variables[1] == 10.0;
+			};
+
+			// the machine can stop between any two statements, a condition waiting for its IF included
+			VirtualMachine vm;
+			vm.load(program);
+			vector<vector<uint8_t>> images;
+			while (vm.step(1) == status::exhausted)
+				images.push_back(vm.snapshot());
+			for (auto& image : images)
+				Assert::IsTrue(restored(image));
+
+			// at the start of line 40 : no operand, the line, the position, 1 byte for executed, no DATA read, no INPUT, no error
+			vector<uint8_t> image;
+			vector<uint8_t> condition;
+			for (auto& i : images)
+			{
+				size_t n = i.size();
+				if (i[n - 6] == 40 && i[n - 5] == 0 && image.empty())
+					image = i;
+				if (i[n - 6] == 40 && i[n - 5] != 0 && condition.empty())
+					condition = i;
+			}
+			Assert::IsTrue(!image.empty() && !condition.empty());
+
+			// inside an expression, or at a statement with another stack depth
+			vector<uint8_t> inside = image;
+			inside[inside.size() - 5] = 2;
+			Assert::IsFalse(restored(inside));
+
+			vector<uint8_t> start = condition;
+			start[start.size() - 5] = 0;
+			Assert::IsFalse(restored(start));
+
+			// the accesses of A are not checked, a smaller A is refused, before its DIM it has no size yet
+			VirtualMachine small;
+			small.load(program);
+			Assert::IsTrue(restored(small.snapshot()));
+			small.restore(image);
+			small.arrays[0].resize(1);
+			Assert::IsFalse(restored(small.snapshot()));
+		}
+		TEST_METHOD(TestMethod37)
+		{
+			ExtendedTinyBasic basic;
+			basic.parseLine("10 FOR I=1 TO 10");
+			basic.parseLine("20 LET S=S+I");
+			basic.parseLine("30 NEXT I");
+
+			// verified once, loaded by any number of machines
+			VirtualMachine::Verified program = VirtualMachine::verified(basic.compile());
+			Assert::IsTrue(program.errors().empty());
+			for (int run = 0; run < 2; run++)
+			{
+				VirtualMachine vm;
+				vm.load(program);
+				Assert::IsTrue(vm.step((size_t)-1) == status::finished);
+				Assert::AreEqual(vm.variables[1], 55.0);
+			}
+
+			// a rejected program keeps its errors and does not run
+			VirtualMachine::Program bad;
+			bad[10] = ParserResult(instruction::getvar) + (size_t)0;
+			VirtualMachine::Verified rejected = VirtualMachine::verified(make_shared<const VirtualMachine::Program>(bad));
+			Assert::IsFalse(rejected.errors().empty());
+
+			VirtualMachine vm;
+			vm.load(rejected);
+			Assert::IsTrue(vm.step((size_t)-1) == status::error);
+		}
 	};
 }
@@ -27,25 +27,70 @@
 //SOFTWARE.
 
 #ifdef _DEBUG
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN // without winsock.h, which TinyBasicServer.h replaces by winsock2.h
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX // min and max are the ones of std
+#endif
 #include <Windows.h>
 #endif
 
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <set>
 #include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 #include <time.h>
 
-#ifdef ORIGINAL
-typedef int number;
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define TINYBASIC_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TINYBASIC_TARGET(features)
 #else
-typedef double number;
+#define TINYBASIC_TARGET(features) __attribute__((target(features)))
+#endif
 #endif
 
 using namespace std;
 
+// variable sets : how many variables a program can use and how they are named
+
+struct OriginalVariables
+{
+    static constexpr size_t size = 26; // A to Z
+    static constexpr bool long_names = false;
+};
+
+struct ExtendedVariables
+{
+    static constexpr size_t size = 256;
+    static constexpr bool long_names = true;
+};
+
 enum class instruction : size_t
 {
     nop = 0,
@@ -77,809 +122,5871 @@ enum class instruction : size_t
     input = 21,
 
     call = 22,
-    call_proc = 23
+    call_proc = 23,
+
+    abs = 24,
+    acs = 25,
+    asn = 26,
+    atn = 27,
+    cos = 28,
+    exp = 29,
+    integer = 30,
+    ln = 31,
+    log = 32,
+    pi = 33,
+    rnd = 34,
+    sgn = 35,
+    sin = 36,
+    sqr = 37,
+    tan = 38,
+
+    call_host = 39,
+    call_host_proc = 40,
+
+    dim = 41,
+    getarr = 42,
+    setarr = 43,
+    getarr_unchecked = 44,
+    setarr_unchecked = 45,
+
+    forloop = 46,
+    next = 47,
+
+    print_value = 48,
+    print_string = 49,
+    print_tab = 50,
+    print_end = 51,
+
+    parallel = 52,      // PARALLEL FOR, laid out as forloop
+    reduce = 53,        // a reduction of the PARALLEL FOR before it : kind and variable
+
+    // MAT statements on whole arrays, the operation is an arithmetic instruction, a math function or nop
+    mat_binary = 54,    // operation, target, left and right arrays
+    mat_scalar = 55,    // operation, target, array, scalar first, then the scalar expression (nop fills the target)
+    mat_function = 56,  // operation, target, array (nop copies)
+    mat_sum = 57,       // array
+    mat_dot = 58,       // two arrays
+
+    send = 59,          // channel and value expressions
+    recv = 60,          // variable, then the channel expression
+
+    // the values of DATA lines, gathered by the compiler in one segment at the end of line 0 and read in place
+    data = 61,          // count, then the values
+    read = 62,          // variable
+    mat_read = 63,      // array, filled from the segment
+    restore = 64,       // a word : the line to read from, patched by the compiler with its position in the segment
+
+    // values the compiler keeps for itself, out of the variables the host sees
+    settemp = 65,       // temporary, then the expression
+    gettemp = 66        // temporary
 };
 
-template<class T> class stack : private vector<T>
+// how the private copies of a reduction variable are merged at the end of a PARALLEL FOR
+enum class reduction : size_t
 {
-public:
-    void push() { vector<T>::push_back((T)0); }
-    void push(T t) { vector<T>::push_back(t); }
-    void pop() { vector<T>::pop_back(); }
-    const T& top() { return vector<T>::back(); }
-
-    const T& operator[](size_t i) const { return vector<T>::operator[](vector<T>::size() - (i + 1)); }
-    T& operator[](size_t i) { return vector<T>::operator[](vector<T>::size() - (i + 1)); }
+    sum = 0,
+    min = 1,
+    max = 2
 };
 
-class InstructionSet : private vector<size_t>
+// result of running a slice of a program
+enum class status
 {
-public:
-    size_t size() const { return vector<size_t>::size(); }
-
-    void push(instruction instruction) { vector<size_t>::push_back((size_t)instruction); }
-    void push_value(number value) { vector<size_t>::push_back(*(size_t*)&value); }
-    void push_value(size_t value) { vector<size_t>::push_back(value); }
+    finished,   // END or last line reached
+    exhausted,  // the instruction budget or the deadline of the slice is over
+    waiting,    // INPUT needs a value, see BasicVirtualMachine::input
+    error,      // the program stopped on an error, see BasicVirtualMachine::error
+    blocked     // SEND or RECV waits for its channel, step again later
+};
 
-    void operator+=(const InstructionSet& set)
-    {
-        if (size() > 0)
-            vector<size_t>::insert(end(), set.begin(), set.end());
-        else
-            this->operator=(set);
-    }
+// counters kept by each machine at little cost, see BasicVirtualMachine::counters and MetricsAggregator
+struct Metrics
+{
+    uint64_t runs = 0;              // programs loaded
+    uint64_t instructions = 0;      // instructions dispatched
+    uint64_t lines = 0;             // lines started
+    uint64_t gosub_depth = 0;       // deepest GOSUB nesting
+    uint64_t stack_depth = 0;       // deepest operand stack
+    uint64_t prints = 0;            // PRINT statements
+    uint64_t print_bytes = 0;       // bytes they wrote
+    uint64_t inputs = 0;            // values taken by INPUT
+    uint64_t nanoseconds = 0;       // wall time spent in step()
+};
 
-    size_t operator[](size_t i) const { return vector<size_t>::operator[](i); }
-    size_t& operator[](size_t i) { return vector<size_t>::operator[](i); }
+// what a line cost while profiling, see BasicVirtualMachine::profile and BasicTinyBasic::explain
+struct LineProfile
+{
+    uint64_t runs = 0;              // times the line was started
+    uint64_t instructions = 0;      // instructions dispatched by its statements
+    uint64_t nanoseconds = 0;       // wall time of its statements
 };
 
-class VirtualMachine;
+// a reason why a compiled program cannot run, see BasicVirtualMachine::verify
+struct LoadError
+{
+    size_t line;
+    size_t instruction;
+    string message;
+};
 
-class Instruction : public function<void(VirtualMachine&)>
+// operand stack of a fixed capacity, given once per program by the depth its verification finds : pushes never check or grow
+template<class T> class stack
 {
 public:
-    Instruction(function<void(VirtualMachine&)> f) : function<void(VirtualMachine&)>(f) {}
+    void clear() { used = 0; }
+    void allocate(size_t n) { values.assign(n, (T)0); used = 0; }
+    size_t capacity() const { return values.size(); }
+    size_t size() const { return used; }
+    size_t peak() const { return highest; }
+    void push() { push((T)0); }
+    void push(T t) { values[used++] = t; highest = max(highest, used); }
+    void pop() { used--; }
+    const T& top() { return values[used - 1]; }
+
+    // the last n values, in the order they were pushed
+    const T* data(size_t n) const { return values.data() + used - n; }
+
+    const T& operator[](size_t i) const { return values[used - (i + 1)]; }
+    T& operator[](size_t i) { return values[used - (i + 1)]; }
+
+private:
+    vector<T> values;
+    size_t used = 0;
+    size_t highest = 0; // deepest the stack has been
 };
 
-class VirtualMachine
+// contiguous values aligned on a cache line, used as storage for DIM arrays
+template<class T> class aligned_array
 {
+    static constexpr size_t alignment = 64;
+
+    T* values = nullptr;
+    size_t count = 0;
+    bool owner = true;
+
 public:
+    aligned_array() {}
+    aligned_array(const aligned_array& a) { *this = a; }
+    ~aligned_array() { release(); }
 
-#ifdef ORIGINAL
-    number variables[26];
-#else
-    number variables[256];
-#endif
+    aligned_array& operator=(const aligned_array& a)
+    {
+        if (this != &a)
+        {
+            resize(a.count);
+            copy(a.values, a.values + a.count, values);
+        }
+        return *this;
+    }
 
-private:
-    map<size_t, InstructionSet> program;
+    // reallocates n values set to zero
+    void resize(size_t n)
+    {
+        release();
 
-    stack<number> stack;
+        if (n > SIZE_MAX / sizeof(T))
+            throw bad_array_new_length();
 
-    size_t current_instruction;
-    map<size_t, InstructionSet>::iterator current_line;
+        if (n > 0)
+        {
+            values = (T*)::operator new(n * sizeof(T), align_val_t(alignment));
+            fill(values, values + n, (T)0);
+        }
+        count = n;
+    }
 
-    vector<Instruction> instructions = {
-        Instruction(&VirtualMachine::i_nop),
-        Instruction(&VirtualMachine::i_push),
-        Instruction(&VirtualMachine::i_pop),
-        Instruction(&VirtualMachine::i_jne), // jump not equal
+    size_t size() const { return count; }
 
-        Instruction(&VirtualMachine::i_plus),
-        Instruction(&VirtualMachine::i_minus),
-        Instruction(&VirtualMachine::i_mult),
-        Instruction(&VirtualMachine::i_div),
+    // uses the values of a without owning them, a must outlive this array and keep its size
+    void share(aligned_array& a)
+    {
+        release();
 
-        Instruction(&VirtualMachine::i_setvar),
-        Instruction(&VirtualMachine::i_getvar),
+        values = a.values;
+        count = a.count;
+        owner = false;
+    }
 
-        Instruction(&VirtualMachine::i_goto),
-        Instruction(&VirtualMachine::i_gosub),
-        Instruction(&VirtualMachine::i_return),
+    const T& operator[](size_t i) const { return values[i]; }
+    T& operator[](size_t i) { return values[i]; }
 
-        Instruction(&VirtualMachine::i_end),
+    const T* data() const { return values; }
+    T* data() { return values; }
 
-        Instruction(&VirtualMachine::i_eq),
-        Instruction(&VirtualMachine::i_ne),
-        Instruction(&VirtualMachine::i_gt),
-        Instruction(&VirtualMachine::i_lt),
-        Instruction(&VirtualMachine::i_ge),
-        Instruction(&VirtualMachine::i_le),
+private:
+    void release()
+    {
+        if (values && owner)
+            ::operator delete(values, align_val_t(alignment));
 
-        Instruction(&VirtualMachine::i_print),
-        Instruction(&VirtualMachine::i_input),
+        values = nullptr;
+        count = 0;
+        owner = true;
+    }
+};
 
-        Instruction(&VirtualMachine::i_call),
-        Instruction(&VirtualMachine::i_call_proc),
-    };
+// a line of bytecode : one byte opcodes, each followed by its immediates
+// variables, arrays, counts and lengths are varints, numbers take the size of the number type
+// and pointers and the NEXT line of a FOR, which is patched later, take a full word
+template<class number> class BasicInstructionSet : private vector<uint8_t>
+{
+public:
+    size_t size() const { return vector<uint8_t>::size(); }
 
-private:
+    void push(instruction instruction) { push_back((uint8_t)instruction); }
+    void push_value(number value) { append(&value, sizeof(number)); }
 
-    void i_push()
+    void push_value(size_t value)
     {
-        stack.push(*(number*)(&current_line->second[current_instruction])); // var name
-        current_instruction++;
+        for (; value >= 0x80; value >>= 7)
+            push_back((uint8_t)(value | 0x80));
+        push_back((uint8_t)value);
     }
 
-    void i_pop()
+    void push_word(size_t value) { append(&value, sizeof(size_t)); }
+
+    void push_string(const string& text)
     {
-        stack.pop();
+        push_value(text.size());
+        append(text.data(), text.size());
     }
 
-    void i_jne()
+    // a word on its own, to be added to an instruction by the parser
+    static BasicInstructionSet word(size_t value)
     {
-        if (!stack.top())
-        {
-            size_t j = current_line->second[current_instruction + 1];
-            current_instruction += j;
-        }
-        else
-        {
-            current_instruction++;
-        }
-        stack.pop();
+        BasicInstructionSet set;
+        set.push_word(value);
+        return set;
     }
 
-    void i_plus()
+    // a line already encoded elsewhere, see BasicStaticProgram
+    static BasicInstructionSet bytes(const uint8_t* code, size_t n)
     {
-        execInstruction();
-        execInstruction();
-
-        stack[1] += stack[0];
-        stack.pop();
+        BasicInstructionSet set;
+        set.append(code, n);
+        return set;
     }
 
-    void i_minus()
-    {
-        execInstruction();
-        execInstruction();
+    // the bytes from i to j, to compare or copy an expression
+    string_view view(size_t i, size_t j) const { return string_view((const char*)data() + i, j - i); }
+    BasicInstructionSet slice(size_t i, size_t j) const { return bytes(data() + i, j - i); }
 
-        stack[1] -= stack[0];
-        stack.pop();
-    }
+    instruction op(size_t i) const { return (instruction)vector<uint8_t>::operator[](i); }
 
-    void i_mult()
+    // the readers move i past what they read
+    size_t read(size_t& i) const
     {
-        execInstruction();
-        execInstruction();
+        const uint8_t* p = data();
+        if (p[i] < 0x80)
+            return p[i++];
 
-        stack[1] *= stack[0];
-        stack.pop();
+        size_t value = p[i] & 0x7f;
+        for (size_t shift = 7; p[i++] & 0x80; shift += 7)
+            value |= (size_t)(p[i] & 0x7f) << shift;
+
+        return value;
     }
 
-    void i_div()
-    {
-        execInstruction();
-        execInstruction();
+    size_t readWord(size_t& i) const { size_t value; memcpy(&value, data() + i, sizeof(size_t)); i += sizeof(size_t); return value; }
+    number value(size_t& i) const { number value; memcpy(&value, data() + i, sizeof(number)); i += sizeof(number); return value; }
 
-        stack[1] /= stack[0];
-        stack.pop();
+    string_view text(size_t& i) const
+    {
+        size_t length = read(i);
+        string_view text((const char*)data() + i, length);
+        i += length;
+        return text;
     }
 
-    void i_eq()
+    // where the instruction after the one at i starts, 0 if the line ends in the middle of it or the opcode is unknown
+    size_t next(size_t i) const
     {
-        execInstruction();
-        execInstruction();
+        if (i >= size() || (size_t)op(i) > (size_t)instruction::gettemp)
+            return 0;
 
-        stack[1] = stack[1] == stack[0];
-        stack.pop();
-    }
+        size_t varints = 1, words = 0, values = 0;
+        switch (op(i++))
+        {
+        case instruction::push:
+            varints = 0;
+            values = 1;
+            break;
+
+        case instruction::forloop:
+        case instruction::parallel:
+        case instruction::call:
+        case instruction::call_proc:
+            words = 1;
+            break;
+
+        case instruction::restore:
+            varints = 0;
+            words = 1;
+            break;
+
+        case instruction::reduce:
+        case instruction::mat_dot:
+            varints = 2;
+            break;
+
+        case instruction::mat_function:
+            varints = 3;
+            break;
+
+        case instruction::mat_binary:
+        case instruction::mat_scalar:
+            varints = 4;
+            break;
+
+        case instruction::call_host:
+        case instruction::call_host_proc:
+            words = 2;
+            break;
+
+        case instruction::jne:
+        case instruction::got:
+        case instruction::gosub:
+        case instruction::setvar:
+        case instruction::getvar:
+        case instruction::input:
+        case instruction::dim:
+        case instruction::getarr:
+        case instruction::setarr:
+        case instruction::getarr_unchecked:
+        case instruction::setarr_unchecked:
+        case instruction::next:
+        case instruction::print_end:
+        case instruction::mat_sum:
+        case instruction::recv:
+        case instruction::read:
+        case instruction::mat_read:
+        case instruction::settemp:
+        case instruction::gettemp:
+            break;
+
+        // the number of values, then the values
+        case instruction::data:
+        {
+            size_t count = 0;
+            for (size_t shift = 0; ; shift += 7)
+            {
+                if (i >= size() || shift >= 64)
+                    return 0;
 
-    void i_ne()
-    {
-        execInstruction();
-        execInstruction();
+                uint8_t byte = vector<uint8_t>::operator[](i++);
+                count |= (size_t)(byte & 0x7f) << shift;
 
-        stack[1] = stack[1] != stack[0];
-        stack.pop();
-    }
+                if (!(byte & 0x80))
+                    break;
+            }
+            return count <= (size() - i) / sizeof(number) ? i + count * sizeof(number) : 0;
+        }
 
-    void i_gt()
-    {
-        execInstruction();
-        execInstruction();
+        // the length of the text, then the text
+        case instruction::print_string:
+        {
+            size_t length = 0;
+            for (size_t shift = 0; ; shift += 7)
+            {
+                if (i >= size() || shift >= 64)
+                    return 0;
 
-        stack[1] = stack[1] >= stack[0];
-        stack.pop();
-    }
+                uint8_t byte = vector<uint8_t>::operator[](i++);
+                length |= (size_t)(byte & 0x7f) << shift;
 
-    void i_lt()
-    {
-        execInstruction();
-        execInstruction();
+                if (!(byte & 0x80))
+                    break;
+            }
+            return length <= size() - i ? i + length : 0;
+        }
 
-        stack[1] = stack[1] < stack[0];
-        stack.pop();
-    }
+        default:
+            varints = 0;
+            break;
+        }
 
-    void i_ge()
-    {
-        execInstruction();
-        execInstruction();
+        for (; varints > 0; varints--)
+        {
+            do
+            {
+                if (i >= size())
+                    return 0;
+            } while (vector<uint8_t>::operator[](i++) & 0x80);
+        }
 
-        stack[1] = stack[1] >= stack[0];
-        stack.pop();
+        i += words * sizeof(size_t) + values * sizeof(number);
+        return i <= size() ? i : 0;
     }
 
-    void i_le()
+    void patch(size_t i, instruction op) { vector<uint8_t>::operator[](i) = (uint8_t)op; }
+    void patchWord(size_t i, size_t value) { memcpy(data() + i, &value, sizeof(size_t)); }
+
+    void operator+=(const BasicInstructionSet& set)
     {
-        execInstruction();
-        execInstruction();
+        if (size() > 0)
+            vector<uint8_t>::insert(end(), set.begin(), set.end());
+        else
+            this->operator=(set);
+    }
 
-        stack[1] = stack[1] <= stack[0];
-        stack.pop();
+private:
+    void append(const void* bytes, size_t n)
+    {
+        insert(end(), (const uint8_t*)bytes, (const uint8_t*)bytes + n);
     }
+};
 
-    void i_print()
+// kernels of the MAT statements : elementwise arithmetic, scalar broadcast, sums and dot products over whole arrays
+// the generic version is plain loops, double has AVX2 and SSE2 versions chosen when the program runs
+enum class simd
+{
+    none,
+    sse2,
+    avx2
+};
+
+inline simd simdLevel()
+{
+    static simd level = []
     {
-        execInstruction();
+#if defined(TINYBASIC_X86) && defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        int leaves = info[0];
 
-        cout << stack.top() << endl;
+        __cpuid(info, 1);
+        bool sse2 = (info[3] >> 26) & 1;
+        bool avx = ((info[2] >> 27) & 1) && ((info[2] >> 28) & 1) && (_xgetbv(0) & 6) == 6; // the OS saves the AVX registers
 
-        stack.pop();
-    }
+        bool avx2 = false;
+        if (leaves >= 7)
+        {
+            __cpuidex(info, 7, 0);
+            avx2 = avx && ((info[1] >> 5) & 1);
+        }
 
-    void i_input()
-    {
-        cout << "? ";
-        cin >> variables[current_line->second[current_instruction]];
-    }
+        return avx2 ? simd::avx2 : sse2 ? simd::sse2 : simd::none;
+#elif defined(TINYBASIC_X86)
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") ? simd::avx2 : __builtin_cpu_supports("sse2") ? simd::sse2 : simd::none;
+#else
+        return simd::none;
+#endif
+    }();
 
-    void i_setvar()
-    {
-        size_t variable = current_line->second[current_instruction];
-        current_instruction++;
-        execInstruction();
+    return level;
+}
 
-        variables[variable] = stack.top();
-        stack.pop();
+template<class number> struct ArrayKernels
+{
+    static number combine(instruction op, number x, number y)
+    {
+        switch (op)
+        {
+        case instruction::plus: return x + y;
+        case instruction::minus: return x - y;
+        case instruction::mult: return x * y;
+        default: return x / y;
+        }
     }
 
-    void i_getvar()
+    // out = a op b
+    static void binary(instruction op, number* out, const number* a, const number* b, size_t n)
     {
-        stack.push(variables[current_line->second[current_instruction]]);
-        current_instruction++;
+        for (size_t i = 0; i < n; i++)
+            out[i] = combine(op, a[i], b[i]);
     }
 
-    void i_goto()
+    // out = a op s, or s op a when swapped
+    static void broadcast(instruction op, number* out, const number* a, number s, bool swapped, size_t n)
     {
-        execInstruction();
-        size_t line = (size_t)stack.top();
-        stack.pop();
-
-        current_line = program.find(line);
-        current_line--;
-
-        current_instruction = current_line->second.size();
+        for (size_t i = 0; i < n; i++)
+            out[i] = swapped ? combine(op, s, a[i]) : combine(op, a[i], s);
     }
 
-    void i_gosub()
+    // out = f(a), op is the instruction of f
+    static void apply(instruction, number(*f)(number), number* out, const number* a, size_t n)
     {
-        execInstruction();
-        size_t line = (size_t)stack.top();
-        stack.pop();
-
-        current_line++;
-
-        stack.push((number)current_line->first);
-
-        current_line = program.find(line);
-        current_line--;
-
-        current_instruction = current_line->second.size();
+        for (size_t i = 0; i < n; i++)
+            out[i] = f(a[i]);
     }
 
-    void i_return()
+    static number sum(const number* a, size_t n)
     {
-        size_t line = (size_t)stack.top();
-
-        current_line = program.find(line);
-        current_line--;
-
-        current_instruction = current_line->second.size();
+        number total = 0;
+        for (size_t i = 0; i < n; i++)
+            total += a[i];
+        return total;
     }
 
-    void i_end()
+    static number dot(const number* a, const number* b, size_t n)
     {
-        current_line = program.end();
+        number total = 0;
+        for (size_t i = 0; i < n; i++)
+            total += a[i] * b[i];
+        return total;
     }
+};
 
-    void i_call()
+template<> struct ArrayKernels<double>
+{
+    // each operation has a scalar form and, on x86, its AVX2 and SSE2 forms
+    struct Add
     {
-        stack.push();
+        static double scalar(double x, double y) { return x + y; }
+#ifdef TINYBASIC_X86
+        TINYBASIC_TARGET("avx2") static __m256d avx2(__m256d x, __m256d y) { return _mm256_add_pd(x, y); }
+        TINYBASIC_TARGET("sse2") static __m128d sse2(__m128d x, __m128d y) { return _mm_add_pd(x, y); }
+#endif
+    };
 
-        size_t nb_of_params = current_line->second[current_instruction];
-        current_instruction++;
+    struct Sub
+    {
+        static double scalar(double x, double y) { return x - y; }
+#ifdef TINYBASIC_X86
+        TINYBASIC_TARGET("avx2") static __m256d avx2(__m256d x, __m256d y) { return _mm256_sub_pd(x, y); }
+        TINYBASIC_TARGET("sse2") static __m128d sse2(__m128d x, __m128d y) { return _mm_sub_pd(x, y); }
+#endif
+    };
 
-        void(*callback)(VirtualMachine&) = (void(*)(VirtualMachine&))current_line->second[current_instruction];
-        current_instruction++;
+    struct Mul
+    {
+        static double scalar(double x, double y) { return x * y; }
+#ifdef TINYBASIC_X86
+        TINYBASIC_TARGET("avx2") static __m256d avx2(__m256d x, __m256d y) { return _mm256_mul_pd(x, y); }
+        TINYBASIC_TARGET("sse2") static __m128d sse2(__m128d x, __m128d y) { return _mm_mul_pd(x, y); }
+#endif
+    };
 
-        for (size_t i = 0; i < nb_of_params; i++)
-            execInstruction();
+    struct Div
+    {
+        static double scalar(double x, double y) { return x / y; }
+#ifdef TINYBASIC_X86
+        TINYBASIC_TARGET("avx2") static __m256d avx2(__m256d x, __m256d y) { return _mm256_div_pd(x, y); }
+        TINYBASIC_TARGET("sse2") static __m128d sse2(__m128d x, __m128d y) { return _mm_div_pd(x, y); }
+#endif
+    };
 
-        callback(*this);
+    template<class Op> struct Swapped
+    {
+        static double scalar(double x, double y) { return Op::scalar(y, x); }
+#ifdef TINYBASIC_X86
+        TINYBASIC_TARGET("avx2") static __m256d avx2(__m256d x, __m256d y) { return Op::avx2(y, x); }
+        TINYBASIC_TARGET("sse2") static __m128d sse2(__m128d x, __m128d y) { return Op::sse2(y, x); }
+#endif
+    };
 
-        for (size_t i = 0; i < nb_of_params; i++)
-            stack.pop();
+#ifdef TINYBASIC_X86
+    // the vector loops return where the scalar loop goes on
+    template<class Op> TINYBASIC_TARGET("avx2") static size_t binaryAvx2(double* out, const double* a, const double* b, size_t n)
+    {
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(out + i, Op::avx2(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+        return i;
     }
 
-    void i_call_proc()
+    template<class Op> TINYBASIC_TARGET("sse2") static size_t binarySse2(double* out, const double* a, const double* b, size_t n)
     {
-        size_t nb_of_params = current_line->second[current_instruction];
-        current_instruction++;
-
-        void(*callback)(VirtualMachine&) = (void(*)(VirtualMachine&))current_line->second[current_instruction];
-        current_instruction++;
-
-        for (size_t i = 0; i < nb_of_params; i++)
-            execInstruction();
-
-        callback(*this);
-
-        for (size_t i = 0; i < nb_of_params; i++)
-            stack.pop();
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(out + i, Op::sse2(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+        return i;
     }
 
-    void i_nop() {}
+    template<class Op> TINYBASIC_TARGET("avx2") static size_t broadcastAvx2(double* out, const double* a, double s, size_t n)
+    {
+        __m256d b = _mm256_set1_pd(s);
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+            _mm256_storeu_pd(out + i, Op::avx2(_mm256_loadu_pd(a + i), b));
+        return i;
+    }
 
-    void execInstruction()
+    template<class Op> TINYBASIC_TARGET("sse2") static size_t broadcastSse2(double* out, const double* a, double s, size_t n)
     {
-        function<void(VirtualMachine&)> instruction = instructions[current_line->second[current_instruction]];
-        current_instruction++;
-        instruction(*this);
+        __m128d b = _mm_set1_pd(s);
+        size_t i = 0;
+        for (; i + 2 <= n; i += 2)
+            _mm_storeu_pd(out + i, Op::sse2(_mm_loadu_pd(a + i), b));
+        return i;
     }
 
-    void exec()
+    // ABS, SQR and INT, the other functions have no vector form and run in the scalar loop
+    TINYBASIC_TARGET("avx2") static size_t applyAvx2(instruction op, double* out, const double* a, size_t n)
     {
-        current_instruction = 0;
-        while (current_instruction < current_line->second.size())
+        __m256d sign = _mm256_set1_pd(-0.0);
+        size_t i = 0;
+        switch (op)
         {
-            execInstruction();
+        case instruction::abs:
+            for (; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_andnot_pd(sign, _mm256_loadu_pd(a + i)));
+            break;
+
+        case instruction::sqr:
+            for (; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+            break;
+
+        case instruction::integer:
+            for (; i + 4 <= n; i += 4)
+                _mm256_storeu_pd(out + i, _mm256_floor_pd(_mm256_loadu_pd(a + i)));
+            break;
+
+        default:
+            break;
         }
+        return i;
     }
 
-public:
+    TINYBASIC_TARGET("avx2") static double dotAvx2(const double* a, const double* b, size_t n)
+    {
+        // two accumulators hide the latency of the additions
+        __m256d t0 = _mm256_setzero_pd(), t1 = _mm256_setzero_pd();
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            t0 = _mm256_add_pd(t0, b ? _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)) : _mm256_loadu_pd(a + i));
+            t1 = _mm256_add_pd(t1, b ? _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)) : _mm256_loadu_pd(a + i + 4));
+        }
 
-    number operator[](size_t i) const { return stack[i]; }
-    number& operator[](size_t i) { return stack[i]; }
+        double lanes[4];
+        _mm256_storeu_pd(lanes, _mm256_add_pd(t0, t1));
+        double total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
 
-    number top()
-    {
-        return stack.top();
+        for (; i < n; i++)
+            total += b ? a[i] * b[i] : a[i];
+        return total;
     }
 
-    void run(const map<size_t, InstructionSet>& p)
+    TINYBASIC_TARGET("sse2") static double dotSse2(const double* a, const double* b, size_t n)
     {
-        program = p;
-        program[0] = InstructionSet();
+        __m128d t0 = _mm_setzero_pd(), t1 = _mm_setzero_pd();
+        size_t i = 0;
+        for (; i + 4 <= n; i += 4)
+        {
+            t0 = _mm_add_pd(t0, b ? _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)) : _mm_loadu_pd(a + i));
+            t1 = _mm_add_pd(t1, b ? _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)) : _mm_loadu_pd(a + i + 2));
+        }
 
-        current_line = program.begin();
-        current_line++;
+        double lanes[2];
+        _mm_storeu_pd(lanes, _mm_add_pd(t0, t1));
+        double total = lanes[0] + lanes[1];
 
-#ifdef _DEBUG
-        LARGE_INTEGER s, e;
-        QueryPerformanceCounter(&s);
+        for (; i < n; i++)
+            total += b ? a[i] * b[i] : a[i];
+        return total;
+    }
 #endif
 
-        try
+    template<class Op> static void binary(double* out, const double* a, const double* b, size_t n)
+    {
+        size_t i = 0;
+#ifdef TINYBASIC_X86
+        switch (simdLevel())
         {
-            while (current_line != program.end())
-            {
-                exec();
-                current_line++;
-            }
+        case simd::avx2: i = binaryAvx2<Op>(out, a, b, n); break;
+        case simd::sse2: i = binarySse2<Op>(out, a, b, n); break;
+        default: break;
         }
-        catch (...) {}
-        
-#ifdef _DEBUG
-        QueryPerformanceCounter(&e);
-        cout << e.QuadPart - s.QuadPart << endl;
 #endif
+        for (; i < n; i++)
+            out[i] = Op::scalar(a[i], b[i]);
     }
-};
-
-class ParserResult
-{
-private:
-    bool valid;
-    variant<size_t, number, string, InstructionSet> value;
-public:
 
-    ParserResult(bool b) { valid = b; }
-    operator bool() const { return valid; }
-
-    ParserResult(number d) { value = d; valid = true; }
-    operator number() const { return get<number>(value); }
-
-    ParserResult(size_t s) { value = s; valid = true; }
-    operator size_t() const { return get<size_t>(value); }
-
-    ParserResult(instruction i) { InstructionSet set; set.push(i); value = set; valid = true; }
-
-    ParserResult(InstructionSet is) { valid = true; value = is; }
-    operator InstructionSet() const { return get<InstructionSet>(value); }
+    template<class Op> static void broadcast(double* out, const double* a, double s, size_t n)
+    {
+        size_t i = 0;
+#ifdef TINYBASIC_X86
+        switch (simdLevel())
+        {
+        case simd::avx2: i = broadcastAvx2<Op>(out, a, s, n); break;
+        case simd::sse2: i = broadcastSse2<Op>(out, a, s, n); break;
+        default: break;
+        }
+#endif
+        for (; i < n; i++)
+            out[i] = Op::scalar(a[i], s);
+    }
 
-    ParserResult operator+(const ParserResult& b)
+    template<class Op> static void broadcast(double* out, const double* a, double s, bool swapped, size_t n)
     {
-        InstructionSet result = *this;
-        result += (InstructionSet)b;
+        if (swapped)
+            broadcast<Swapped<Op>>(out, a, s, n);
+        else
+            broadcast<Op>(out, a, s, n);
+    }
 
-        return result;
+    static void binary(instruction op, double* out, const double* a, const double* b, size_t n)
+    {
+        switch (op)
+        {
+        case instruction::plus: binary<Add>(out, a, b, n); break;
+        case instruction::minus: binary<Sub>(out, a, b, n); break;
+        case instruction::mult: binary<Mul>(out, a, b, n); break;
+        default: binary<Div>(out, a, b, n); break;
+        }
     }
 
-    ParserResult operator+(size_t s)
+    static void broadcast(instruction op, double* out, const double* a, double s, bool swapped, size_t n)
     {
-        InstructionSet result = *this;
-        result.push_value(s);
+        switch (op)
+        {
+        case instruction::plus: broadcast<Add>(out, a, s, swapped, n); break;
+        case instruction::minus: broadcast<Sub>(out, a, s, swapped, n); break;
+        case instruction::mult: broadcast<Mul>(out, a, s, swapped, n); break;
+        default: broadcast<Div>(out, a, s, swapped, n); break;
+        }
+    }
 
-        return result;
+    static void apply(instruction op, double(*f)(double), double* out, const double* a, size_t n)
+    {
+        size_t i = 0;
+#ifdef TINYBASIC_X86
+        if (simdLevel() == simd::avx2)
+            i = applyAvx2(op, out, a, n);
+#endif
+        for (; i < n; i++)
+            out[i] = f(a[i]);
     }
 
-    ParserResult operator+(number d)
+    // b is null for a sum
+    static double dot(const double* a, const double* b, size_t n)
     {
-        InstructionSet result = *this;
-        result.push_value(d);
+#ifdef TINYBASIC_X86
+        switch (simdLevel())
+        {
+        case simd::avx2: return dotAvx2(a, b, n);
+        case simd::sse2: return dotSse2(a, b, n);
+        default: break;
+        }
+#endif
+        double total = 0;
+        for (size_t i = 0; i < n; i++)
+            total += b ? a[i] * b[i] : a[i];
+        return total;
+    }
 
-        return result;
+    static double sum(const double* a, size_t n)
+    {
+        return dot(a, nullptr, n);
     }
 };
 
-ParserResult operator+(instruction i, const ParserResult& r)
+// a bounded queue of numbers between machines, see BasicVirtualMachine::bind
+// SEND and RECV never wait inside the channel : when it is full or empty the machine steps out with status::blocked
+template<class number> class Channel
 {
-    InstructionSet result;
-    result.push(i);
-    result += (InstructionSet)r;
+public:
+    virtual ~Channel() {}
 
-    return result;
-}
+    virtual bool trySend(number value) = 0;
+    virtual bool tryReceive(number& value) = 0;
+};
 
-class TinyBasic
+// one machine sends and one receives, each side only writes its own index
+template<class number> class SpscChannel : public Channel<number>
 {
-private:
-
-    map<size_t, InstructionSet> program;
-    map<size_t, string> source;
+    vector<number> slots;
+    size_t mask;
 
-#ifndef ORIGINAL
-    size_t nextvariable = -1;
-    map<string, size_t> variables;
-#endif
-
-    string empty;
-    string& line = empty;
-    size_t seek = 0;
+    alignas(64) atomic<size_t> head{ 0 };  // next to receive
+    size_t seen_tail = 0;                   // what the receiver last read of tail
 
-    map<string, function<ParserResult(TinyBasic&)>> instructions = {
-        { "CALL", &TinyBasic::parseCall},
-        { "END", &TinyBasic::parseEnd},
-        { "GOSUB", &TinyBasic::parseGosub},
-        { "GOTO", &TinyBasic::parseGoto},
-        { "IF", &TinyBasic::parseIf},
-        { "INPUT", &TinyBasic::parseInput},
-        { "LET", &TinyBasic::parseLet},
-        { "LIST", &TinyBasic::parseList},
-        { "PRINT", &TinyBasic::parsePrint},
-        { "RETURN", &TinyBasic::parseReturn},
-        { "RUN", &TinyBasic::parseRun},
-    };
-
-public:
-
-    map<string, tuple<size_t, void(*)(VirtualMachine&), bool>> functions;
-    map<string, tuple<size_t, void(*)(VirtualMachine&), bool>> commands;
+    alignas(64) atomic<size_t> tail{ 0 };  // next to send
+    size_t seen_head = 0;                   // what the sender last read of head
 
 public:
-
-    void parseLine(const string& aline)
+    // the capacity is rounded up to a power of two
+    explicit SpscChannel(size_t capacity)
     {
-        line = aline;
-        parse();
+        size_t size = 1;
+        while (size < capacity)
+            size *= 2;
+
+        slots.resize(size);
+        mask = size - 1;
     }
 
-    int loop()
+    bool trySend(number value) override
     {
-        cout << "Tiny Basic v0.1 by Fred Morales" << endl;
-
-        while (true)
+        size_t t = tail.load(memory_order_relaxed);
+        if (t - seen_head == slots.size())
         {
-            getline(cin, line);
-
-            parse();
+            seen_head = head.load(memory_order_acquire);
+            if (t - seen_head == slots.size())
+                return false;
         }
 
+        slots[t & mask] = value;
+        tail.store(t + 1, memory_order_release);
         return true;
     }
 
-    int run()
+    bool tryReceive(number& value) override
     {
-        VirtualMachine vm;
-        return run(vm);
+        size_t h = head.load(memory_order_relaxed);
+        if (h == seen_tail)
+        {
+            seen_tail = tail.load(memory_order_acquire);
+            if (h == seen_tail)
+                return false;
+        }
+
+        value = slots[h & mask];
+        head.store(h + 1, memory_order_release);
+        return true;
     }
+};
 
-    int run(VirtualMachine& vm)
+// any number of senders and receivers : each cell has a sequence number telling whose turn it is
+template<class number> class MpmcChannel : public Channel<number>
+{
+    struct Cell
     {
-        cout << "Tiny Basic v0.1 by Fred Morales" << endl;
-
-        vm.run(program);
+        atomic<size_t> sequence;
+        number value;
+    };
 
-        return true;
-    }
+    unique_ptr<Cell[]> cells;
+    size_t mask;
 
-private:
+    alignas(64) atomic<size_t> tail{ 0 };  // next to send
+    alignas(64) atomic<size_t> head{ 0 };  // next to receive
 
-    bool eol()
+public:
+    // the capacity is rounded up to a power of two, at least 2
+    explicit MpmcChannel(size_t capacity)
     {
-        return seek >= line.size();
+        size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+
+        cells.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++)
+            cells[i].sequence.store(i, memory_order_relaxed);
+        mask = size - 1;
     }
 
-    void eatBlank()
+    bool trySend(number value) override
     {
-        while (!eol() && (line[seek] == ' ' || line[seek] == '\t'))
-            seek++;
+        size_t t = tail.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = cells[t & mask];
+            ptrdiff_t turn = (ptrdiff_t)cell.sequence.load(memory_order_acquire) - (ptrdiff_t)t;
+
+            if (turn == 0)
+            {
+                if (tail.compare_exchange_weak(t, t + 1, memory_order_relaxed))
+                {
+                    cell.value = value;
+                    cell.sequence.store(t + 1, memory_order_release);
+                    return true;
+                }
+            }
+            else if (turn < 0)
+                return false;
+            else
+                t = tail.load(memory_order_relaxed);
+        }
     }
 
-    ParserResult parse()
+    bool tryReceive(number& value) override
     {
-        seek = 0;
-
-        if (ParserResult num = parseNumber())
+        size_t h = head.load(memory_order_relaxed);
+        while (true)
         {
-            size_t s = seek;
-            if (ParserResult set = parseStatement())
+            Cell& cell = cells[h & mask];
+            ptrdiff_t turn = (ptrdiff_t)cell.sequence.load(memory_order_acquire) - (ptrdiff_t)(h + 1);
+
+            if (turn == 0)
             {
-                number n = num;
-                program[(size_t)n] = set;
-                source[(size_t)n] = &line[s];
+                if (head.compare_exchange_weak(h, h + 1, memory_order_relaxed))
+                {
+                    value = cell.value;
+                    cell.sequence.store(h + mask + 1, memory_order_release);
+                    return true;
+                }
             }
-            return true;
-        }
-        else
-        {
-            return parseStatement();
+            else if (turn < 0)
+                return false;
+            else
+                h = head.load(memory_order_relaxed);
         }
+    }
+};
 
-        return false;
+// threads shared by the PARALLEL FOR loops of every machine
+class WorkerPool
+{
+    mutex lock;
+    condition_variable wakeup;
+    deque<function<void()>> tasks;
+    vector<thread> workers;
+    bool stopping = false;
+
+public:
+    explicit WorkerPool(size_t threads)
+    {
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back(&WorkerPool::work, this);
     }
 
-    bool parse(char c)
+    ~WorkerPool()
     {
-        if (line[seek] == c)
         {
-            seek++;
-            return true;
+            lock_guard<mutex> guard(lock);
+            stopping = true;
         }
+        wakeup.notify_all();
 
-        return false;
+        for (thread& worker : workers)
+            worker.join();
     }
 
-    bool parse(const string& string)
+    // the thread that calls run() takes part
+    size_t size() const { return workers.size() + 1; }
+
+    // runs task(0) to task(n - 1) and returns when they are all done, a task must not call run()
+    void run(size_t n, const function<void(size_t)>& task)
     {
-        size_t i = 0;
-        while (line[seek] == string[i])
+        atomic<size_t> next{ 0 };
+        size_t helpers = min(n, size()) - (n > 0);
+        size_t pending = helpers;
+        condition_variable finished;
+
+        auto claim = [&]
         {
-            seek++;
-            i++;
+            for (size_t i; (i = next++) < n; )
+                task(i);
+        };
+
+        {
+            lock_guard<mutex> guard(lock);
+            for (size_t h = 0; h < helpers; h++)
+            {
+                tasks.push_back([&]
+                {
+                    claim();
+
+                    lock_guard<mutex> guard(lock);
+                    if (--pending == 0)
+                        finished.notify_one();
+                });
+            }
         }
+        wakeup.notify_all();
 
-        eatBlank();
+        claim();
 
-        return i == string.size();
+        unique_lock<mutex> guard(lock);
+        finished.wait(guard, [&] { return pending == 0; });
     }
 
-    ParserResult parseNumber()
+    static WorkerPool& shared()
     {
-        if (!eol() && line[seek] >= '0' && line[seek] <= '9')
-        {
-            number num = (number)(line[seek] - (size_t)'0');
+        static WorkerPool pool(max(thread::hardware_concurrency(), 1u) - 1);
+        return pool;
+    }
 
-            seek++;
-            while (!eol() && line[seek] >= '0' && line[seek] <= '9')
+private:
+    void work()
+    {
+        while (true)
+        {
+            function<void()> task;
             {
-                num = num * 10 + (line[seek] - (size_t)'0');
+                unique_lock<mutex> guard(lock);
+                wakeup.wait(guard, [this] { return stopping || !tasks.empty(); });
 
-                seek++;
-            }
+                if (tasks.empty())
+                    return;
 
-            eatBlank();
+                task = move(tasks.front());
+                tasks.pop_front();
+            }
 
-            return num;
+            task();
         }
+    }
+};
 
-        return false;
+template<class VM> class Instruction : public function<void(VM&)>
+{
+public:
+    Instruction(function<void(VM&)> f) : function<void(VM&)>(f) {}
+};
+
+template<class number, class VariableSet, size_t W> class BasicLockstepMachine;
+template<class number, class VariableSet> class BasicTinyBasic;
+
+template<class number, class VariableSet> class BasicVirtualMachine
+{
+    template<class, class, size_t> friend class BasicLockstepMachine;
+    template<class, class> friend class BasicTinyBasic;
+
+public:
+    typedef BasicInstructionSet<number> InstructionSet;
+    typedef map<size_t, InstructionSet> Program;
+
+    number variables[VariableSet::size] = {};
+    vector<aligned_array<number>> arrays;
+
+private:
+    shared_ptr<const Program> program;
+
+    ::stack<number> stack;
+
+    size_t current_instruction;
+    typename Program::const_iterator current_line;
+
+    // active FOR loops : the limit and step are evaluated once and NEXT jumps back to the code right after FOR
+    struct Loop
+    {
+        size_t variable;
+        number limit;
+        number step;
+        typename Program::const_iterator line;
+        size_t instruction;
+        bool worker = false;    // the share of a PARALLEL FOR given to a worker, which stops at its end
+    };
+
+    vector<Loop> loops;
+
+    // where each active GOSUB continues on RETURN
+    vector<pair<typename Program::const_iterator, size_t>> returns;
+
+    // inline cache of each GOTO and GOSUB, positions are the line before the target as jump() leaves them
+    struct Site
+    {
+        bool cached = false;
+        size_t value = 0;
+        typename Program::const_iterator line;
+
+        size_t base = 0;
+        size_t stride = 0;
+        vector<typename Program::const_iterator> table;
+    };
+
+    static constexpr size_t max_table = 4096;
+
+    vector<Site> sites;
+
+    size_t executed = 0;        // instructions dispatched since load
+    Metrics metrics;            // over all the loads, instructions and the stack are added when read
+    bool waiting = false;       // INPUT is suspended until a value is supplied
+    bool blocked = false;       // or SEND or RECV until its channel is ready
+    vector<shared_ptr<Channel<number>>> channels;
+
+    // a blocked SEND or RECV : its expressions were evaluated once, only the channel is tried again
+    struct Pending
+    {
+        Channel<number>* channel = nullptr;
+        size_t statement = 0;           // where it starts on the current line
+        size_t variable = (size_t)-1;   // RECV stores there, SEND has none
+        number value = 0;               // what SEND sends
+    } pending;
+    deque<number> inputs;
+    string failure;
+
+    vector<number> temporaries; // values the compiler keeps out of the variables, see hoistInvariants
+    map<size_t, size_t> array_sizes; // fewest elements of the arrays accessed unchecked, see Verification
+    size_t array_limit = (size_t)-1; // elements all the arrays can hold together, see limitArrays
+    string_view data_segment;   // values of the DATA lines, in the shared program
+    size_t data_cursor = 0;     // next value READ takes
+
+    string output;              // text of the PRINT statement being run
+    size_t column = 0;          // where the output is on the current line
+    ostream* console = &cout;   // where PRINT writes, see redirect
+
+    vector<LoadError> load_errors;
+    bool unchecked = false;     // verified program where no instruction can fail inside an expression
+
+    bool profiling = false;
+    map<size_t, LineProfile> profiled; // line -> cost, kept over the loads
+
+    // builtin math functions, computed in the number type of the machine
+    struct math
+    {
+        static number abs(number x) { return (number)std::abs(x); }
+        static number acs(number x) { return (number)std::acos(x); }
+        static number asn(number x) { return (number)std::asin(x); }
+        static number atn(number x) { return (number)std::atan(x); }
+        static number cos(number x) { return (number)std::cos(x); }
+        static number exp(number x) { return (number)std::exp(x); }
+        static number integer(number x) { return (number)std::floor(x); }
+        static number ln(number x) { return (number)std::log(x); }
+        static number log(number x) { return (number)std::log10(x); }
+        static number rnd(number) { return (number)((double)rand() / RAND_MAX); }
+        static number sgn(number x) { return (number)(x == 0 ? 0 : (x < 0 ? -1 : 1)); }
+        static number sin(number x) { return (number)std::sin(x); }
+        static number sqr(number x) { return (number)std::sqrt(x); }
+        static number tan(number x) { return (number)std::tan(x); }
+    };
+
+    // handlers by opcode, each expression evaluates its operands on the stack and leaves its value there
+    static const vector<Instruction<BasicVirtualMachine>>& stackInstructions()
+    {
+        static const vector<Instruction<BasicVirtualMachine>> table = {
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_nop),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_push),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_pop),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_jne), // jump not equal
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_arithmetic<std::plus<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_arithmetic<std::minus<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_arithmetic<std::multiplies<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_div),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_setvar),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_getvar),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_goto),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_gosub),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_return),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_end),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_compare<std::equal_to<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_compare<std::not_equal_to<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_compare<std::greater<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_compare<std::less<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_compare<std::greater_equal<number>>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_compare<std::less_equal<number>>),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_input),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_call),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_call_proc),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::abs>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::acs>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::asn>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::atn>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::cos>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::exp>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::integer>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::ln>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::log>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_pi),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::rnd>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::sgn>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::sin>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::sqr>),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_function<&math::tan>),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_call_host),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_call_host_proc),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_dim),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_getarr),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_setarr),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_getarr_unchecked),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_setarr_unchecked),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_for),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_next),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print_value),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print_string),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print_tab),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print_end),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_parallel),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_reduce),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_mat_binary),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_mat_scalar),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_mat_function),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_mat_sum),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_mat_dot),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_send),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_recv),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_data),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_read),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_mat_read),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_restore),
+
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_settemp),
+            Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_gettemp),
+        };
+
+        return table;
     }
 
-    ParserResult parseStatement()
+    vector<Instruction<BasicVirtualMachine>> instructions = stackInstructions();
+
+private:
+
+    void i_push()
     {
-        if (ParserResult statement = parseToken())
-        {
-            return statement;
-        }
+        stack.push(current_line->second.value(current_instruction));
+    }
 
-        return false;
+    void i_pop()
+    {
+        stack.pop();
     }
 
-    ParserResult parseToken()
+    void i_jne()
     {
-        size_t i = seek;
+        size_t j = current_line->second.read(current_instruction); // length of the statement
+        if (!stack.top())
+            current_instruction += j;
+        stack.pop();
+    }
 
-        if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+    // +, - and * are instantiated once per number type with the matching std functor
+    template<class operation> void i_arithmetic()
+    {
+        execInstruction();
+        execInstruction();
+
+        stack[1] = operation()(stack[1], stack[0]);
+        stack.pop();
+    }
+
+    void i_div()
+    {
+        execInstruction();
+        execInstruction();
+
+        if constexpr (is_integral_v<number>)
         {
-            seek++;
-            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
-            {
+            if (stack[0] == 0)
+                throw domain_error("division by zero");
+        }
+
+        stack[1] /= stack[0];
+        stack.pop();
+    }
+
+    // comparisons always produce 0 or 1 in the number type
+    template<class comparison> void i_compare()
+    {
+        execInstruction();
+        execInstruction();
+
+        stack[1] = comparison()(stack[1], stack[0]) ? (number)1 : (number)0;
+        stack.pop();
+    }
+
+    // PRINT fills the output buffer and writes it once per statement
+    void i_print()
+    {
+        execInstruction();
+
+        format(output, stack.top());
+        stack.pop();
+
+        output += '\n';
+        write();
+    }
+
+    void i_print_value()
+    {
+        execInstruction();
+
+        format(output, stack.top());
+        stack.pop();
+    }
+
+    void i_print_string()
+    {
+        output += current_line->second.text(current_instruction);
+    }
+
+    void i_print_tab()
+    {
+        tab(output, column);
+    }
+
+    void i_print_end()
+    {
+        if (current_line->second.read(current_instruction))
+            output += '\n';
+        write();
+    }
+
+    void write()
+    {
+        metrics.prints++;
+        metrics.print_bytes += output.size();
+
+        console->write(output.data(), output.size());
+        column = columnAfter(output, column);
+        output.clear();
+    }
+
+    // shortest text that reads back as the same number
+    static void format(string& out, number value)
+    {
+        size_t used = out.size();
+        out.resize(used + 32);
+
+        to_chars_result result = to_chars(&out[used], &out[0] + out.size(), value);
+        out.resize(result.ptr - &out[0]);
+    }
+
+    // a comma in a PRINT list moves to the next zone of 8 columns, column is where out starts
+    static void tab(string& out, size_t column)
+    {
+        out.append(8 - columnAfter(out, column) % 8, ' ');
+    }
+
+    static size_t columnAfter(const string& out, size_t column)
+    {
+        size_t newline = out.rfind('\n');
+        return newline == string::npos ? column + out.size() : out.size() - newline - 1;
+    }
+
+    Channel<number>* channel(number id)
+    {
+        if (id < 0 || (size_t)id >= channels.size() || !channels[(size_t)id])
+        {
+            stop("unbound channel");
+            return nullptr;
+        }
+
+        return channels[(size_t)id].get();
+    }
+
+    // the machine steps out after the statement, advance() tries the channel again before going on
+    void block(Channel<number>* c, size_t statement, size_t variable, number value)
+    {
+        pending = { c, statement, variable, value };
+        waiting = true;
+        blocked = true;
+    }
+
+    // false while the channel of the pending statement is not ready
+    bool retry()
+    {
+        bool ready = pending.variable == (size_t)-1 ? pending.channel->trySend(pending.value) : pending.channel->tryReceive(variables[pending.variable]);
+        if (ready)
+            pending = Pending();
+        return ready;
+    }
+
+    void i_send()
+    {
+        size_t statement = current_instruction - 1;
+
+        execInstruction();
+        execInstruction();
+
+        Channel<number>* c = channel(stack[1]);
+        if (c && !c->trySend(stack[0]))
+            block(c, statement, (size_t)-1, stack[0]);
+
+        stack.pop();
+        stack.pop();
+    }
+
+    void i_recv()
+    {
+        size_t statement = current_instruction - 1;
+        size_t variable = current_line->second.read(current_instruction);
+
+        execInstruction();
+        Channel<number>* c = channel(stack.top());
+        stack.pop();
+
+        if (c && !c->tryReceive(variables[variable]))
+            block(c, statement, variable, 0);
+    }
+
+    // the segment is not run, READ finds it when the program is loaded
+    void i_data()
+    {
+        current_instruction += current_line->second.read(current_instruction) * sizeof(number);
+    }
+
+    size_t dataCount() const { return data_segment.size() / sizeof(number); }
+
+    void i_read()
+    {
+        size_t variable = current_line->second.read(current_instruction);
+
+        if (data_cursor >= dataCount())
+        {
+            stop("out of DATA");
+            return;
+        }
+
+        memcpy(&variables[variable], data_segment.data() + data_cursor++ * sizeof(number), sizeof(number));
+    }
+
+    // every element of the array in one copy
+    void i_mat_read()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        size_t n = matSize(array);
+
+        if (data_cursor > dataCount() || n > dataCount() - data_cursor)
+        {
+            stop("out of DATA");
+            return;
+        }
+
+        if (n > 0)
+            memcpy(matData(array), data_segment.data() + data_cursor * sizeof(number), n * sizeof(number));
+        data_cursor += n;
+    }
+
+    void i_restore()
+    {
+        data_cursor = current_line->second.readWord(current_instruction);
+    }
+
+    // suspends the machine when no value has been supplied, INPUT is executed again on resume
+    void i_input()
+    {
+        if (inputs.empty())
+        {
+            current_instruction--;
+            waiting = true;
+            return;
+        }
+
+        variables[current_line->second.read(current_instruction)] = inputs.front();
+        inputs.pop_front();
+        metrics.inputs++;
+    }
+
+    void i_setvar()
+    {
+        size_t variable = current_line->second.read(current_instruction);
+        execInstruction();
+
+        variables[variable] = stack.top();
+        stack.pop();
+    }
+
+    void i_settemp()
+    {
+        size_t temporary = current_line->second.read(current_instruction);
+        execInstruction();
+
+        temporaries[temporary] = stack.top();
+        stack.pop();
+    }
+
+    void i_gettemp()
+    {
+        stack.push(temporaries[current_line->second.read(current_instruction)]);
+    }
+
+    void i_getvar()
+    {
+        stack.push(variables[current_line->second.read(current_instruction)]);
+    }
+
+    void i_dim()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        execInstruction();
+
+        number size = stack.top();
+        stack.pop();
+
+        if (size < 0)
+        {
+            stop("negative array size");
+            return;
+        }
+
+        if (!allocatable(size))
+        {
+            stop("array too large");
+            return;
+        }
+
+        // checked before anything is allocated, a large DIM is a single instruction that budgets of time cannot stop
+        size_t others = arrayElements(array);
+        if (others > array_limit || (size_t)size >= array_limit - others)
+        {
+            stop("array limit exceeded");
+            return;
+        }
+
+        // a verified program runs without exception handling, an allocation that fails stops it here
+        try
+        {
+            if (array >= arrays.size())
+                arrays.resize(array + 1);
+
+            arrays[array].resize((size_t)size + 1);
+        }
+        catch (const bad_alloc&)
+        {
+            stop("out of memory");
+        }
+    }
+
+    // elements of all the arrays but one
+    size_t arrayElements(size_t except) const
+    {
+        size_t elements = 0;
+        for (size_t a = 0; a < arrays.size(); a++)
+        {
+            if (a != except)
+                elements += arrays[a].size();
+        }
+        return elements;
+    }
+
+    // a size DIM can convert and count in bytes without overflow, NaN and infinities are not
+    static bool allocatable(number size)
+    {
+        return isfinite((double)size) && (double)size < (double)(SIZE_MAX / sizeof(number));
+    }
+
+    // the index is left on the stack and replaced by the value
+    void i_getarr()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        execInstruction();
+
+        size_t index = checkIndex(array, stack[0]); // before arrays[array], which may not exist
+        stack[0] = arrays[array][index];
+    }
+
+    void i_setarr()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        execInstruction();
+        execInstruction();
+
+        if (!inBounds(array, stack[1]))
+        {
+            stop("array index out of bounds");
+            return;
+        }
+
+        arrays[array][(size_t)stack[1]] = stack[0];
+        stack.pop();
+        stack.pop();
+    }
+
+    // emitted by the compiler only where the index is known to be within the array
+    void i_getarr_unchecked()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        execInstruction();
+
+        stack[0] = arrays[array][(size_t)stack[0]];
+    }
+
+    void i_setarr_unchecked()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        execInstruction();
+        execInstruction();
+
+        arrays[array][(size_t)stack[1]] = stack[0];
+        stack.pop();
+        stack.pop();
+    }
+
+    void i_for()
+    {
+        size_t variable = current_line->second.read(current_instruction);
+        size_t next = current_line->second.readWord(current_instruction); // line of the matching NEXT, 0 if unknown
+
+        execInstruction();
+        execInstruction();
+        execInstruction();
+
+        Loop loop = { variable, stack[1], stack[0], current_line, current_instruction };
+        variables[variable] = stack[2];
+        stack.pop();
+        stack.pop();
+        stack.pop();
+
+        // a loop started again on the same variable replaces the previous one and the loops it contains
+        for (size_t i = 0; i < loops.size(); i++)
+        {
+            if (loops[i].variable == variable)
+            {
+                loops.resize(i);
+                break;
+            }
+        }
+
+        if (next != 0 && !inLoop(variables[variable], loop.limit, loop.step))
+        {
+            current_line = program->find(next);
+            current_instruction = current_line->second.size();
+            return;
+        }
+
+        loops.push_back(loop);
+    }
+
+    void i_next()
+    {
+        size_t variable = current_line->second.read(current_instruction);
+
+        // NEXT on an outer variable also ends the loops it contains
+        if (variable != (size_t)-1)
+        {
+            while (!loops.empty() && loops.back().variable != variable)
+                loops.pop_back();
+        }
+
+        if (loops.empty())
+        {
+            stop("NEXT without FOR");
+            return;
+        }
+
+        Loop& loop = loops.back();
+        number& value = variables[loop.variable];
+        value += loop.step;
+
+        if (inLoop(value, loop.limit, loop.step))
+        {
+            current_line = loop.line;
+            current_instruction = loop.instruction;
+        }
+        else
+        {
+            if (loop.worker)
+                current_line = program->end();
+            loops.pop_back();
+        }
+    }
+
+    // the iterations are split in contiguous shares run by machines on the worker pool
+    // each one has its own variables and shares the arrays, the reductions are merged at the end
+    // and the other variables are taken from the share with the last iterations
+    void i_parallel()
+    {
+        size_t variable = current_line->second.read(current_instruction);
+        size_t next = current_line->second.readWord(current_instruction);
+
+        execInstruction();
+        execInstruction();
+        execInstruction();
+
+        number start = stack[2], limit = stack[1], step = stack[0];
+        stack.pop();
+        stack.pop();
+        stack.pop();
+
+        vector<pair<reduction, size_t>> reductions;
+        while (current_instruction < current_line->second.size() && current_line->second.op(current_instruction) == instruction::reduce)
+        {
+            current_instruction++;
+            reduction kind = (reduction)current_line->second.read(current_instruction);
+            reductions.push_back({ kind, current_line->second.read(current_instruction) });
+        }
+
+        if (step == 0)
+        {
+            stop("STEP 0 in PARALLEL FOR");
+            return;
+        }
+
+        size_t iterations = inLoop(start, limit, step) ? (size_t)((limit - start) / step) + 1 : 0;
+
+        WorkerPool& pool = WorkerPool::shared();
+        size_t shares = min(iterations, pool.size());
+
+        vector<BasicVirtualMachine> workers(shares);
+        for (size_t w = 0; w < shares; w++)
+        {
+            BasicVirtualMachine& worker = workers[w];
+            size_t first = iterations * w / shares, last = iterations * (w + 1) / shares - 1;
+
+            worker.program = program;
+            copy(begin(variables), end(variables), begin(worker.variables));
+            worker.arrays.resize(arrays.size());
+            for (size_t a = 0; a < arrays.size(); a++)
+                worker.arrays[a].share(arrays[a]);
+            worker.sites.assign(sites.size(), Site());
+            worker.unchecked = unchecked;
+            worker.stack.allocate(stack.capacity());
+            worker.temporaries = temporaries;
+            worker.instructions = instructions;
+
+            for (auto& r : reductions)
+            {
+                if (r.first == reduction::sum)
+                    worker.variables[r.second] = 0;
+            }
+
+            worker.variables[variable] = start + (number)first * step;
+            worker.current_line = current_line;
+            worker.current_instruction = current_instruction;
+
+            // half a step past the last iteration so that rounding cannot add or drop one
+            Loop loop = { variable, start + (number)last * step + step / 2, step, current_line, current_instruction, true };
+            worker.loops.push_back(loop);
+        }
+
+        pool.run(shares, [&](size_t w) { workers[w].advance((size_t)-1); });
+
+        for (BasicVirtualMachine& worker : workers)
+        {
+            executed += worker.executed;
+            metrics.lines += worker.metrics.lines;
+
+            if (!worker.failure.empty())
+            {
+                failure = worker.failure;
+                current_line = program->end();
+                return;
+            }
+        }
+
+        vector<number> merged;
+        for (auto& r : reductions)
+        {
+            number value = variables[r.second];
+            for (BasicVirtualMachine& worker : workers)
+            {
+                number share = worker.variables[r.second];
+                switch (r.first)
+                {
+                case reduction::sum: value += share; break;
+                case reduction::min: value = min(value, share); break;
+                case reduction::max: value = max(value, share); break;
+                }
+            }
+            merged.push_back(value);
+        }
+
+        if (!workers.empty())
+            copy(begin(workers.back().variables), end(workers.back().variables), begin(variables));
+        for (size_t r = 0; r < reductions.size(); r++)
+            variables[reductions[r].second] = merged[r];
+
+        variables[variable] = start + (number)iterations * step;
+
+        current_line = program->find(next);
+        current_instruction = current_line->second.size();
+    }
+
+    // read by the PARALLEL FOR before it
+    void i_reduce()
+    {
+        current_line->second.read(current_instruction);
+        current_line->second.read(current_instruction);
+    }
+
+    // MAT statements work on all the elements of arrays of the same size, in a single dispatch
+    size_t matSize(size_t array) const
+    {
+        return array < arrays.size() ? arrays[array].size() : 0;
+    }
+
+    number* matData(size_t array)
+    {
+        return array < arrays.size() ? arrays[array].data() : nullptr;
+    }
+
+    bool matZero(size_t array)
+    {
+        const number* values = matData(array);
+        return find(values, values + matSize(array), (number)0) != values + matSize(array);
+    }
+
+    void i_mat_binary()
+    {
+        const InstructionSet& set = current_line->second;
+        instruction op = (instruction)set.read(current_instruction);
+        size_t target = set.read(current_instruction);
+        size_t left = set.read(current_instruction);
+        size_t right = set.read(current_instruction);
+
+        size_t n = matSize(target);
+        if (matSize(left) != n || matSize(right) != n)
+        {
+            stop("MAT arrays of different sizes");
+            return;
+        }
+
+        if (is_integral_v<number> && op == instruction::div && matZero(right))
+        {
+            stop("division by zero");
+            return;
+        }
+
+        ArrayKernels<number>::binary(op, matData(target), matData(left), matData(right), n);
+    }
+
+    void i_mat_scalar()
+    {
+        const InstructionSet& set = current_line->second;
+        instruction op = (instruction)set.read(current_instruction);
+        size_t target = set.read(current_instruction);
+        size_t array = set.read(current_instruction);
+        bool swapped = set.read(current_instruction) != 0;
+
+        execInstruction();
+        number s = stack.top();
+        stack.pop();
+
+        size_t n = matSize(target);
+        if (op == instruction::nop)
+        {
+            fill(matData(target), matData(target) + n, s);
+            return;
+        }
+
+        if (matSize(array) != n)
+        {
+            stop("MAT arrays of different sizes");
+            return;
+        }
+
+        if (is_integral_v<number> && op == instruction::div && (swapped ? matZero(array) : s == 0))
+        {
+            stop("division by zero");
+            return;
+        }
+
+        ArrayKernels<number>::broadcast(op, matData(target), matData(array), s, swapped, n);
+    }
+
+    void i_mat_function()
+    {
+        const InstructionSet& set = current_line->second;
+        instruction op = (instruction)set.read(current_instruction);
+        size_t target = set.read(current_instruction);
+        size_t array = set.read(current_instruction);
+
+        size_t n = matSize(target);
+        if (matSize(array) != n)
+        {
+            stop("MAT arrays of different sizes");
+            return;
+        }
+
+        if (op == instruction::nop)
+            copy(matData(array), matData(array) + n, matData(target));
+        else
+            ArrayKernels<number>::apply(op, mathFunction(op), matData(target), matData(array), n);
+    }
+
+    void i_mat_sum()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        stack.push(ArrayKernels<number>::sum(matData(array), matSize(array)));
+    }
+
+    // inside an expression, a mismatch cannot stop the machine in place
+    void i_mat_dot()
+    {
+        size_t a = current_line->second.read(current_instruction);
+        size_t b = current_line->second.read(current_instruction);
+
+        if (matSize(a) != matSize(b))
+            throw out_of_range("MAT arrays of different sizes");
+
+        stack.push(ArrayKernels<number>::dot(matData(a), matData(b), matSize(a)));
+    }
+
+    static number(*mathFunction(instruction op))(number)
+    {
+        switch (op)
+        {
+        case instruction::abs: return &math::abs;
+        case instruction::acs: return &math::acs;
+        case instruction::asn: return &math::asn;
+        case instruction::atn: return &math::atn;
+        case instruction::cos: return &math::cos;
+        case instruction::exp: return &math::exp;
+        case instruction::integer: return &math::integer;
+        case instruction::ln: return &math::ln;
+        case instruction::log: return &math::log;
+        case instruction::rnd: return &math::rnd;
+        case instruction::sgn: return &math::sgn;
+        case instruction::sin: return &math::sin;
+        case instruction::sqr: return &math::sqr;
+        default: return &math::tan;
+        }
+    }
+
+    static bool inLoop(number value, number limit, number step)
+    {
+        return step < 0 ? value >= limit : value <= limit;
+    }
+
+    bool inBounds(size_t array, number index)
+    {
+        return array < arrays.size() && index >= 0 && (size_t)index < arrays[array].size();
+    }
+
+    // array reads happen inside expressions and cannot stop the machine in place
+    size_t checkIndex(size_t array, number index)
+    {
+        if (!inBounds(array, index))
+            throw out_of_range("array index out of bounds");
+
+        return (size_t)index;
+    }
+
+    void i_goto()
+    {
+        size_t site = current_line->second.read(current_instruction);
+        execInstruction();
+        size_t line = (size_t)stack.top();
+        stack.pop();
+
+        jump(site, line);
+    }
+
+    void i_gosub()
+    {
+        size_t site = current_line->second.read(current_instruction);
+        execInstruction();
+        size_t line = (size_t)stack.top();
+        stack.pop();
+
+        returns.push_back({ current_line, current_instruction });
+        metrics.gosub_depth = max(metrics.gosub_depth, (uint64_t)returns.size());
+
+        jump(site, line);
+    }
+
+    // the last target of the jump, then the lines of a series base + k * stride, then a search in the program
+    void jump(size_t site, size_t line)
+    {
+        Site& cache = sites[site];
+
+        if (cache.cached && cache.value == line)
+        {
+            current_line = cache.line;
+            current_instruction = current_line->second.size();
+            return;
+        }
+
+        if (cache.stride != 0 && line >= cache.base && (line - cache.base) % cache.stride == 0)
+        {
+            size_t k = (line - cache.base) / cache.stride;
+            if (k < cache.table.size())
+            {
+                current_line = cache.table[k];
+                current_instruction = current_line->second.size();
+                return;
+            }
+        }
+
+        jump(line);
+        if (current_line == program->end())
+            return;
+
+        learn(cache, line);
+
+        cache.cached = true;
+        cache.value = line;
+        cache.line = current_line;
+    }
+
+    // a second target turns the site into a series, a target out of it widens the series
+    void learn(Site& cache, size_t line)
+    {
+        if (!cache.cached || cache.value == line)
+            return;
+
+        size_t base, stride;
+        if (cache.stride == 0)
+        {
+            base = min(cache.value, line);
+            stride = max(cache.value, line) - base;
+        }
+        else
+        {
+            base = min(cache.base, line);
+            stride = gcd(cache.stride, max(cache.base, line) - base);
+        }
+
+        if (base == cache.base && stride == cache.stride)
+            return;
+
+        cache.base = base;
+        cache.stride = stride;
+        cache.table.clear();
+
+        // consecutive lines of the series, up to the first one missing
+        for (size_t target = base; cache.table.size() < max_table; target += stride)
+        {
+            typename Program::const_iterator l = program->find(target);
+            if (target == 0 || l == program->end())
+                break;
+
+            cache.table.push_back(prev(l));
+        }
+    }
+
+    void i_return()
+    {
+        if (returns.empty())
+        {
+            stop("RETURN without GOSUB");
+            return;
+        }
+
+        current_line = returns.back().first;
+        current_instruction = returns.back().second;
+        returns.pop_back();
+    }
+
+    // ends the current line on the one before the target, the next line to run is the target
+    void jump(size_t line)
+    {
+        typename Program::const_iterator target = program->find(line);
+        if (line == 0 || target == program->end())
+        {
+            stop("undefined line");
+            return;
+        }
+
+        current_line = prev(target);
+        current_instruction = current_line->second.size();
+    }
+
+    // errors of statements end the run where they are raised, there is nothing to unwind
+    void stop(const char* message)
+    {
+        failure = message;
+        current_line = program->end();
+    }
+
+    void i_end()
+    {
+        current_line = program->end();
+    }
+
+    void i_call()
+    {
+        stack.push();
+
+        size_t nb_of_params = current_line->second.read(current_instruction);
+
+        void(*callback)(BasicVirtualMachine&) = (void(*)(BasicVirtualMachine&))current_line->second.readWord(current_instruction);
+
+        for (size_t i = 0; i < nb_of_params; i++)
+            execInstruction();
+
+        callback(*this);
+
+        for (size_t i = 0; i < nb_of_params; i++)
+            stack.pop();
+    }
+
+    void i_call_proc()
+    {
+        size_t nb_of_params = current_line->second.read(current_instruction);
+
+        void(*callback)(BasicVirtualMachine&) = (void(*)(BasicVirtualMachine&))current_line->second.readWord(current_instruction);
+
+        for (size_t i = 0; i < nb_of_params; i++)
+            execInstruction();
+
+        callback(*this);
+
+        for (size_t i = 0; i < nb_of_params; i++)
+            stack.pop();
+    }
+
+    // host callables : the parameters are handed to the trampoline in source order, without going through the stack accessors
+    number callHost()
+    {
+        size_t nb_of_params = current_line->second.read(current_instruction);
+
+        number(*trampoline)(void*, const number*) = (number(*)(void*, const number*))current_line->second.readWord(current_instruction);
+        void* context = (void*)current_line->second.readWord(current_instruction);
+
+        for (size_t i = 0; i < nb_of_params; i++)
+            execInstruction();
+
+        number result = trampoline(context, stack.data(nb_of_params));
+
+        for (size_t i = 0; i < nb_of_params; i++)
+            stack.pop();
+
+        return result;
+    }
+
+    void i_call_host()
+    {
+        number result = callHost();
+        stack.push(result);
+    }
+
+    void i_call_host_proc()
+    {
+        callHost();
+    }
+
+    // builtin functions : the argument is evaluated on the stack and replaced in place by the result
+    template<number(*f)(number)> void i_function()
+    {
+        execInstruction();
+
+        stack[0] = f(stack[0]);
+    }
+
+    void i_pi()
+    {
+        stack.push((number)3.14159265358979323846);
+    }
+
+    void i_nop() {}
+
+    // operands cached in registers, see cacheOperands : an expression is evaluated by recursion, each operator keeps its
+    // left operand in a local while the right one is evaluated and returns its value, nothing goes through the stack
+    number evaluate()
+    {
+        instruction op = current_line->second.op(current_instruction++);
+        executed++;
+        return evaluate(op);
+    }
+
+    // the opcode is read, its immediates are next
+    number evaluate(instruction op)
+    {
+        const InstructionSet& set = current_line->second;
+
+        switch (op)
+        {
+        case instruction::push: return set.value(current_instruction);
+        case instruction::getvar: return variables[set.read(current_instruction)];
+        case instruction::gettemp: return temporaries[set.read(current_instruction)];
+
+        case instruction::plus: { number a = evaluate(); return a + evaluate(); }
+        case instruction::minus: { number a = evaluate(); return a - evaluate(); }
+        case instruction::mult: { number a = evaluate(); return a * evaluate(); }
+
+        case instruction::div:
+        {
+            number a = evaluate();
+            number b = evaluate();
+
+            if constexpr (is_integral_v<number>)
+            {
+                if (b == 0)
+                    throw domain_error("division by zero");
+            }
+
+            return a / b;
+        }
+
+        case instruction::eq: { number a = evaluate(); return a == evaluate() ? (number)1 : (number)0; }
+        case instruction::ne: { number a = evaluate(); return a != evaluate() ? (number)1 : (number)0; }
+        case instruction::gt: { number a = evaluate(); return a > evaluate() ? (number)1 : (number)0; }
+        case instruction::lt: { number a = evaluate(); return a < evaluate() ? (number)1 : (number)0; }
+        case instruction::ge: { number a = evaluate(); return a >= evaluate() ? (number)1 : (number)0; }
+        case instruction::le: { number a = evaluate(); return a <= evaluate() ? (number)1 : (number)0; }
+
+        case instruction::getarr:
+        {
+            size_t array = set.read(current_instruction);
+            size_t index = checkIndex(array, evaluate());
+            return arrays[array][index];
+        }
+
+        case instruction::getarr_unchecked:
+        {
+            size_t array = set.read(current_instruction);
+            return arrays[array][(size_t)evaluate()];
+        }
+
+        case instruction::abs: return math::abs(evaluate());
+        case instruction::acs: return math::acs(evaluate());
+        case instruction::asn: return math::asn(evaluate());
+        case instruction::atn: return math::atn(evaluate());
+        case instruction::cos: return math::cos(evaluate());
+        case instruction::exp: return math::exp(evaluate());
+        case instruction::integer: return math::integer(evaluate());
+        case instruction::ln: return math::ln(evaluate());
+        case instruction::log: return math::log(evaluate());
+        case instruction::pi: return (number)3.14159265358979323846;
+        case instruction::rnd: return math::rnd(evaluate());
+        case instruction::sgn: return math::sgn(evaluate());
+        case instruction::sin: return math::sin(evaluate());
+        case instruction::sqr: return math::sqr(evaluate());
+        case instruction::tan: return math::tan(evaluate());
+
+        case instruction::mat_sum:
+        {
+            size_t array = set.read(current_instruction);
+            return ArrayKernels<number>::sum(matData(array), matSize(array));
+        }
+
+        case instruction::mat_dot:
+        {
+            size_t a = set.read(current_instruction);
+            size_t b = set.read(current_instruction);
+
+            if (matSize(a) != matSize(b))
+                throw out_of_range("MAT arrays of different sizes");
+
+            return ArrayKernels<number>::dot(matData(a), matData(b), matSize(a));
+        }
+
+        // callbacks read their parameters on the stack
+        default:
+        {
+            instructions[(size_t)op](*this);
+            number value = stack.top();
+            stack.pop();
+            return value;
+        }
+        }
+    }
+
+    // an expression reached through the table, where its value is expected on the stack
+    void i_evaluated()
+    {
+        stack.push(evaluate(current_line->second.op(current_instruction - 1)));
+    }
+
+    void i_setvar_cached()
+    {
+        size_t variable = current_line->second.read(current_instruction);
+        variables[variable] = evaluate();
+    }
+
+    void i_settemp_cached()
+    {
+        size_t temporary = current_line->second.read(current_instruction);
+        temporaries[temporary] = evaluate();
+    }
+
+    void i_setarr_cached()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        number index = evaluate();
+        number value = evaluate();
+
+        if (!inBounds(array, index))
+        {
+            stop("array index out of bounds");
+            return;
+        }
+
+        arrays[array][(size_t)index] = value;
+    }
+
+    void i_setarr_unchecked_cached()
+    {
+        size_t array = current_line->second.read(current_instruction);
+        number index = evaluate();
+        arrays[array][(size_t)index] = evaluate();
+    }
+
+    void i_print_cached()
+    {
+        format(output, evaluate());
+
+        output += '\n';
+        write();
+    }
+
+    void i_print_value_cached()
+    {
+        format(output, evaluate());
+    }
+
+    void execInstruction()
+    {
+        function<void(BasicVirtualMachine&)> instruction = instructions[(size_t)current_line->second.op(current_instruction)];
+        current_instruction++;
+        executed++;
+        instruction(*this);
+    }
+
+    // a statement and its operands, what it costs is added to its line
+    void profileInstruction()
+    {
+        LineProfile& line = profiled[current_line->first];
+        if (current_instruction == 0)
+            line.runs++;
+
+        size_t before = executed;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+        execInstruction();
+
+        line.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        line.instructions += executed - before;
+    }
+
+    // what a verification finds out about a program
+    struct Verification
+    {
+        vector<LoadError> errors;
+        set<size_t> arrays;     // arrays given a size by DIM
+        map<size_t, size_t> sizes; // arrays accessed unchecked -> the fewest elements DIM gives them, always a constant
+        size_t depth = 0;       // deepest operand stack
+        size_t sites = 0;       // jump sites numbered by the parser
+        size_t temporaries = 0; // of the compiler
+        bool unchecked = true;
+    };
+
+    // expressions evaluated by an opcode after its immediates
+    static size_t operands(instruction op, const InstructionSet& set, size_t i)
+    {
+        switch (op)
+        {
+        case instruction::plus:
+        case instruction::minus:
+        case instruction::mult:
+        case instruction::div:
+        case instruction::eq:
+        case instruction::ne:
+        case instruction::gt:
+        case instruction::lt:
+        case instruction::ge:
+        case instruction::le:
+        case instruction::setarr:
+        case instruction::setarr_unchecked:
+        case instruction::send:
+            return 2;
+
+        case instruction::setvar:
+        case instruction::settemp:
+        case instruction::got:
+        case instruction::gosub:
+        case instruction::mat_scalar:
+        case instruction::recv:
+        case instruction::print:
+        case instruction::print_value:
+        case instruction::dim:
+        case instruction::getarr:
+        case instruction::getarr_unchecked:
+            return 1;
+
+        case instruction::forloop:
+        case instruction::parallel:
+            return 3;
+
+        case instruction::call:
+        case instruction::call_proc:
+        case instruction::call_host:
+        case instruction::call_host_proc:
+            i++;
+            return set.read(i);
+
+        default:
+            return op >= instruction::abs && op <= instruction::tan && op != instruction::pi ? 1 : 0;
+        }
+    }
+
+    // where the expression or the statement at i ends, its operands included, 0 when it is cut
+    static size_t extent(const InstructionSet& set, size_t i)
+    {
+        size_t end = set.next(i);
+        for (size_t n = end ? operands(set.op(i), set, i) : 0; n > 0 && end; n--)
+            end = extent(set, end);
+        return end;
+    }
+
+    static bool returnsValue(instruction op)
+    {
+        switch (op)
+        {
+        case instruction::push:
+        case instruction::getvar:
+        case instruction::gettemp:
+        case instruction::getarr:
+        case instruction::getarr_unchecked:
+        case instruction::call:
+        case instruction::call_host:
+        case instruction::mat_sum:
+        case instruction::mat_dot:
+            return true;
+
+        default:
+            return (op >= instruction::plus && op <= instruction::div) || (op >= instruction::eq && op <= instruction::le) || (op >= instruction::abs && op <= instruction::tan);
+        }
+    }
+
+    // checks the instruction at i and its operands, base values being already on the stack
+    // returns the position after it, or 0 when it is rejected
+    static size_t verifyInstruction(const Program& program, typename Program::const_iterator line, size_t i, size_t base, Verification& v)
+    {
+        const InstructionSet& set = line->second;
+
+        auto reject = [&](const char* message)
+        {
+            v.errors.push_back({ line->first, i, message });
+            return (size_t)0;
+        };
+
+        if (i >= set.size())
+            return reject("missing operand");
+
+        if ((size_t)set.op(i) > (size_t)instruction::gettemp)
+            return reject("unknown instruction");
+
+        instruction op = set.op(i);
+        size_t next = set.next(i);
+
+        if (next == 0)
+            return reject("missing immediate");
+
+        size_t at = i + 1; // first immediate
+
+        switch (op)
+        {
+        case instruction::jne:
+        case instruction::pop:
+            return reject("condition inside an expression");
+
+        case instruction::setvar:
+        case instruction::getvar:
+        case instruction::input:
+        case instruction::recv:
+        case instruction::read:
+        case instruction::forloop:
+        case instruction::parallel:
+            if (set.read(at) >= VariableSet::size)
+                return reject("invalid variable");
+            if (op == instruction::forloop || op == instruction::parallel)
+            {
+                size_t line = set.readWord(at);
+                if (line != 0 && !program.count(line))
+                    return reject("FOR without its NEXT line");
+                if (line == 0 && op == instruction::parallel)
+                    return reject("PARALLEL FOR without NEXT");
+            }
+            break;
+
+        // as many as there are variables, no more
+        case instruction::settemp:
+        case instruction::gettemp:
+        {
+            size_t temporary = set.read(at);
+            if (temporary >= VariableSet::size)
+                return reject("invalid temporary");
+            v.temporaries = max(v.temporaries, temporary + 1);
+            break;
+        }
+
+        case instruction::reduce:
+            if (set.read(at) > (size_t)reduction::max)
+                return reject("unknown reduction");
+            if (set.read(at) >= VariableSet::size)
+                return reject("invalid variable");
+            break;
+
+        case instruction::mat_binary:
+        case instruction::mat_scalar:
+        {
+            instruction operation = (instruction)set.read(at);
+            bool fill = op == instruction::mat_scalar && operation == instruction::nop;
+            if (!fill && (operation < instruction::plus || operation > instruction::div))
+                return reject("unknown MAT operation");
+            break;
+        }
+
+        case instruction::mat_function:
+        {
+            instruction operation = (instruction)set.read(at);
+            bool function = operation >= instruction::abs && operation <= instruction::tan && operation != instruction::pi;
+            if (operation != instruction::nop && !function)
+                return reject("unknown MAT function");
+            break;
+        }
+
+        case instruction::mat_dot:
+            v.unchecked = false;
+            break;
+
+        case instruction::next:
+        {
+            size_t variable = set.read(at);
+            if (variable != (size_t)-1 && variable >= VariableSet::size)
+                return reject("invalid variable");
+            break;
+        }
+
+        case instruction::got:
+        case instruction::gosub:
+            v.sites = max(v.sites, set.read(at) + 1);
+
+            // constant targets are checked here, computed ones when they are reached
+            if (next < set.size() && set.op(next) == instruction::push && set.next(next) != 0)
+            {
+                at = next + 1;
+                size_t target = (size_t)set.value(at);
+                if (target == 0 || !program.count(target))
+                    return reject("undefined line");
+            }
+            break;
+
+        case instruction::getarr_unchecked:
+        case instruction::setarr_unchecked:
+            if (!v.sizes.count(set.read(at)))
+                return reject("unchecked access to an array without a constant DIM");
+            break;
+
+        case instruction::getarr:
+            v.unchecked = false;
+            break;
+
+        case instruction::div:
+            if (is_integral_v<number>)
+                v.unchecked = false;
+            break;
+
+        case instruction::call:
+        case instruction::call_proc:
+        case instruction::call_host:
+        case instruction::call_host_proc:
+            set.read(at);
+            if (set.readWord(at) == 0)
+                return reject("callback without a function");
+            v.unchecked = false;
+            break;
+
+        default:
+            break;
+        }
+
+        size_t n = operands(op, set, i);
+        if (op == instruction::call)
+            base++; // slot of the result
+
+        for (size_t k = 0; k < n; k++)
+        {
+            next = verifyInstruction(program, line, next, base + k, v);
+            if (next == 0)
+                return 0;
+        }
+
+        v.depth = max(v.depth, base + max(n, (size_t)1));
+        return next;
+    }
+
+    static Verification verifyProgram(const Program& program)
+    {
+        Verification v;
+
+        // the accesses the compiler left unchecked rely on arrays DIM only gives constant sizes
+        map<size_t, size_t> constant;
+        set<size_t> dynamic, unchecked;
+        for (auto& line : program)
+        {
+            const InstructionSet& set = line.second;
+            for (size_t i = 0; i < set.size() && set.next(i) != 0; i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::getarr_unchecked || set.op(i) == instruction::setarr_unchecked)
+                    unchecked.insert(set.read(at));
+
+                if (set.op(i) != instruction::dim)
+                    continue;
+
+                size_t array = set.read(at);
+                v.arrays.insert(array);
+
+                number size = -1;
+                if (set.op(at) == instruction::push && set.next(at) != 0)
+                    size = set.value(++at);
+
+                if (size < 0 || !allocatable(size))
+                    dynamic.insert(array);
+                else if (!constant.count(array) || (size_t)size + 1 < constant[array])
+                    constant[array] = (size_t)size + 1;
+            }
+        }
+
+        for (size_t array : unchecked)
+        {
+            if (constant.count(array) && !dynamic.count(array))
+                v.sizes[array] = constant[array];
+        }
+
+        for (auto line = program.begin(); line != program.end(); line++)
+        {
+            const InstructionSet& set = line->second;
+
+            // statements leave nothing on the stack, a condition leaves one value for the IF that follows
+            size_t values = 0;
+            size_t i = 0;
+
+            while (i < set.size())
+            {
+                instruction op = set.op(i);
+
+                if (op == instruction::jne || op == instruction::pop)
+                {
+                    if (values == 0)
+                    {
+                        v.errors.push_back({ line->first, i, "no value for the condition" });
+                        break;
+                    }
+
+                    size_t next = set.next(i);
+                    size_t at = i + 1;
+                    if (next == 0 || (op == instruction::jne && set.read(at) > set.size() - next))
+                    {
+                        v.errors.push_back({ line->first, i, "IF statement past the end of the line" });
+                        break;
+                    }
+
+                    values--;
+                    i = next;
+                    continue;
+                }
+
+                size_t next = verifyInstruction(program, line, i, values, v);
+                if (next == 0)
+                    break;
+
+                if (returnsValue(op))
+                    values++;
+
+                i = next;
+            }
+
+            if (i >= set.size() && values != 0)
+                v.errors.push_back({ line->first, i, "value left on the stack" });
+        }
+
+        for (auto line = program.begin(); line != program.end(); line++)
+        {
+            const InstructionSet& set = line->second;
+            for (size_t i = 0; i < set.size() && set.next(i) != 0; i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::parallel)
+                {
+                    set.read(at);
+                    size_t next = set.readWord(at);
+                    if (program.count(next))
+                        verifyParallel(program, line, set.next(i), next, v);
+                }
+            }
+        }
+
+        return v;
+    }
+
+    // the body of a PARALLEL FOR runs on other threads : it must stay in the loop, touch nothing shared but
+    // array elements and never wait for the host, from the instruction at i on the FOR line to the NEXT line
+    static void verifyParallel(const Program& program, typename Program::const_iterator line, size_t i, size_t next, Verification& v)
+    {
+        size_t first = line->first;
+
+        for (auto l = line; l != program.end() && l->first <= next; l++, i = 0)
+        {
+            const InstructionSet& set = l->second;
+            for (; i < set.size() && set.next(i) != 0; i = set.next(i))
+            {
+                const char* message = nullptr;
+
+                switch (set.op(i))
+                {
+                case instruction::got:
+                {
+                    size_t at = set.next(i);
+                    if (at >= set.size() || set.op(at) != instruction::push || set.next(at) == 0)
+                        message = "computed GOTO in PARALLEL FOR";
+                    else
+                    {
+                        at++;
+                        size_t target = (size_t)set.value(at);
+                        if (target <= first || target > next)
+                            message = "GOTO out of PARALLEL FOR";
+                    }
+                    break;
+                }
+
+                case instruction::input:
+                    message = "INPUT in PARALLEL FOR";
+                    break;
+
+                case instruction::send:
+                case instruction::recv:
+                    message = "SEND or RECV in PARALLEL FOR";
+                    break;
+
+                case instruction::read:
+                case instruction::mat_read:
+                case instruction::restore:
+                    message = "READ or RESTORE in PARALLEL FOR";
+                    break;
+
+                case instruction::print:
+                case instruction::print_value:
+                case instruction::print_string:
+                case instruction::print_tab:
+                case instruction::print_end:
+                    message = "PRINT in PARALLEL FOR";
+                    break;
+
+                case instruction::gosub:
+                case instruction::ret:
+                    message = "GOSUB or RETURN in PARALLEL FOR";
+                    break;
+
+                case instruction::end:
+                    message = "END in PARALLEL FOR";
+                    break;
+
+                case instruction::dim:
+                    message = "DIM in PARALLEL FOR";
+                    break;
+
+                case instruction::call:
+                case instruction::call_proc:
+                    message = "CALL in PARALLEL FOR";
+                    break;
+
+                // bound callables are not known to be thread safe
+                case instruction::call_host:
+                case instruction::call_host_proc:
+                    message = "host callable in PARALLEL FOR";
+                    break;
+
+                case instruction::parallel:
+                    message = "PARALLEL FOR inside PARALLEL FOR";
+                    break;
+
+                case instruction::mat_binary:
+                case instruction::mat_scalar:
+                case instruction::mat_function:
+                    message = "MAT in PARALLEL FOR";
+                    break;
+
+                default:
+                    break;
+                }
+
+                if (message)
+                    v.errors.push_back({ l->first, i, message });
+            }
+        }
+    }
+
+    // runs from the current position, the loop a verified program runs without exception handling
+    status execute(size_t until)
+    {
+        while (current_line != program->end())
+        {
+            while (current_line != program->end() && current_instruction < current_line->second.size())
+            {
+                if (executed >= until)
+                    return status::exhausted;
+
+                if (profiling)
+                    profileInstruction();
+                else
+                    execInstruction();
+
+                if (waiting)
+                    return blocked ? status::blocked : status::waiting;
+            }
+
+            if (current_line != program->end())
+            {
+                current_line++;
+                current_instruction = 0;
+                metrics.lines++;
+            }
+        }
+
+        return failure.empty() ? status::finished : status::error;
+    }
+
+public:
+
+    // checks a compiled program once : instructions and their operands, stack depth, variables, callbacks and constant jump targets
+    static vector<LoadError> verify(const Program& p)
+    {
+        return verifyProgram(p).errors;
+    }
+
+    // a program with what its verification found, only verified() makes one : load() then takes it as it is
+    class Verified
+    {
+        friend class BasicVirtualMachine;
+
+        shared_ptr<const Program> program;
+        shared_ptr<const Verification> verification;
+
+        Verified(shared_ptr<const Program> program, shared_ptr<const Verification> verification) : program(move(program)), verification(move(verification)) {}
+
+    public:
+        const vector<LoadError>& errors() const { return verification->errors; }
+    };
+
+    // verifies a program once for the machines that load it again and again, see load(const Verified&)
+    static Verified verified(shared_ptr<const Program> p)
+    {
+        if (!p->count(0))
+        {
+            shared_ptr<Program> copy = make_shared<Program>(*p);
+            copy->emplace(0, InstructionSet()); // line 0 holds what the compiler set up before the first line
+            p = copy;
+        }
+
+        shared_ptr<const Verification> verification = make_shared<const Verification>(verifyProgram(*p));
+        return Verified(move(p), move(verification));
+    }
+
+    // loads a program to be run in slices with step() or runUntil(), all the state of the run is kept in the machine
+    void load(const Program& p)
+    {
+        load(make_shared<const Program>(p));
+    }
+
+    // the program is shared, not copied : many machines can run the same compiled program
+    void load(shared_ptr<const Program> p)
+    {
+        load(verified(move(p)));
+    }
+
+    // a program verified before, its code is not walked again
+    void load(const Verified& v)
+    {
+        program = v.program;
+
+        current_line = program->begin();
+        current_instruction = 0;
+
+        metrics.runs++;
+        metrics.instructions += executed;
+
+        stack.clear();
+        loops.clear();
+        returns.clear();
+        inputs.clear();
+
+        executed = 0;
+        waiting = false;
+        blocked = false;
+        pending = Pending();
+        failure.clear();
+
+        // the DATA segment is read where it is, the program is never changed while it is loaded
+        data_segment = string_view();
+        data_cursor = 0;
+
+        const InstructionSet& preamble = program->begin()->second;
+        for (size_t i = 0; i < preamble.size() && preamble.next(i) != 0; i = preamble.next(i))
+        {
+            size_t at = i + 1;
+            if (preamble.op(i) == instruction::data)
+            {
+                size_t count = preamble.read(at);
+                data_segment = preamble.view(at, at + count * sizeof(number));
+            }
+        }
+
+        // a rejected program is never run, a verified one runs without checks where it cannot fail
+        const Verification& verification = *v.verification;
+
+        load_errors = verification.errors;
+        unchecked = load_errors.empty() && verification.unchecked;
+        stack.allocate(verification.depth);
+        temporaries.assign(verification.temporaries, (number)0);
+        array_sizes = verification.sizes;
+        sites.assign(verification.sites, Site());
+
+        if (!load_errors.empty())
+            failure = "line " + to_string(load_errors[0].line) + ": " + load_errors[0].message;
+    }
+
+    const vector<LoadError>& loadErrors() const { return load_errors; }
+
+    // bounds the elements DIM can give all the arrays together, a DIM past it stops the machine
+    void limitArrays(size_t elements)
+    {
+        array_limit = elements;
+    }
+
+    // runs about budget instructions, the budget is checked between statements
+    status step(size_t budget)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        status result = advance(budget);
+        metrics.nanoseconds += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+
+        return result;
+    }
+
+    // counters since the machine was created
+    Metrics counters() const
+    {
+        Metrics current = metrics;
+        current.instructions += executed;
+        current.stack_depth = stack.peak();
+        return current;
+    }
+
+    // measures each line from now on, the clock is read around every statement so it is for tuning, not production
+    void profile(bool enabled)
+    {
+        profiling = enabled;
+        if (enabled)
+            profiled.clear();
+    }
+
+    const map<size_t, LineProfile>& profiles() const { return profiled; }
+
+    // engine that keeps the operands of expressions in registers instead of the operand stack, see evaluate()
+    // the handlers are chosen once here, the instructions dispatched and the results are the same in both engines
+    void cacheOperands(bool enabled)
+    {
+        instructions = stackInstructions();
+        if (!enabled)
+            return;
+
+        for (size_t op = 0; op < instructions.size(); op++)
+        {
+            if (returnsValue((instruction)op) && (instruction)op != instruction::call && (instruction)op != instruction::call_host)
+                instructions[op] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_evaluated);
+        }
+
+        instructions[(size_t)instruction::setvar] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_setvar_cached);
+        instructions[(size_t)instruction::settemp] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_settemp_cached);
+        instructions[(size_t)instruction::setarr] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_setarr_cached);
+        instructions[(size_t)instruction::setarr_unchecked] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_setarr_unchecked_cached);
+        instructions[(size_t)instruction::print] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print_cached);
+        instructions[(size_t)instruction::print_value] = Instruction<BasicVirtualMachine>(&BasicVirtualMachine::i_print_value_cached);
+    }
+
+private:
+    status advance(size_t budget)
+    {
+        if (!failure.empty())
+            return status::error;
+
+        if (waiting)
+        {
+            if (!blocked && inputs.empty())
+                return status::waiting;
+            if (pending.channel && !retry())
+                return status::blocked;
+            waiting = false;
+            blocked = false;
+        }
+
+        size_t stop = budget > (size_t)-1 - executed ? (size_t)-1 : executed + budget;
+
+        if (unchecked)
+            return execute(stop);
+
+        try
+        {
+            return execute(stop);
+        }
+        catch (const exception& e)
+        {
+            failure = e.what();
+        }
+        catch (...)
+        {
+            failure = "unknown error";
+        }
+
+        return status::error;
+    }
+
+public:
+    // runs until the deadline, the clock is read every slice instructions
+    status runUntil(chrono::steady_clock::time_point deadline, size_t slice = 4096)
+    {
+        status s;
+        do
+        {
+            s = step(slice);
+        }
+        while (s == status::exhausted && chrono::steady_clock::now() < deadline);
+
+        return s;
+    }
+
+    template<class Rep, class Period> status runFor(chrono::duration<Rep, Period> duration, size_t slice = 4096)
+    {
+        return runUntil(chrono::steady_clock::now() + duration, slice);
+    }
+
+    // makes a channel available to SEND and RECV under a number, the same channel can be bound in several machines
+    void bind(size_t id, shared_ptr<Channel<number>> channel)
+    {
+        if (id >= channels.size())
+            channels.resize(id + 1);
+        channels[id] = move(channel);
+    }
+
+    // value for a pending or a future INPUT
+    void input(number value)
+    {
+        inputs.push_back(value);
+    }
+
+    const string& error() const { return failure; }
+
+    // sends PRINT to another stream, which starts at its first column
+    void redirect(ostream& out)
+    {
+        console = &out;
+        column = 0;
+    }
+
+    size_t instructionsExecuted() const { return executed; }
+
+    // copy of a paused machine that shares the program and can go on independently
+    BasicVirtualMachine fork() const
+    {
+        return *this;
+    }
+
+    // compact binary image of the state of a paused machine, the program itself is not included
+    vector<uint8_t> snapshot() const
+    {
+        vector<uint8_t> image = { 'T', 'B', 'S', 3, (uint8_t)sizeof(number) };
+
+        size_t used = VariableSet::size;
+        while (used > 0 && variables[used - 1] == 0)
+            used--;
+
+        write(image, used);
+        for (size_t i = 0; i < used; i++)
+            writeValue(image, variables[i]);
+
+        write(image, temporaries.size());
+        for (number value : temporaries)
+            writeValue(image, value);
+
+        write(image, arrays.size());
+        for (auto& array : arrays)
+        {
+            write(image, array.size());
+            for (size_t i = 0; i < array.size(); i++)
+                writeValue(image, array[i]);
+        }
+
+        write(image, stack.size());
+        for (size_t i = stack.size(); i > 0; i--)
+            writeValue(image, stack[i - 1]);
+
+        write(image, returns.size());
+        for (auto& r : returns)
+        {
+            write(image, r.first->first);
+            write(image, r.second);
+        }
+
+        write(image, loops.size());
+        for (auto& loop : loops)
+        {
+            write(image, loop.variable);
+            writeValue(image, loop.limit);
+            writeValue(image, loop.step);
+            write(image, loop.line->first);
+            write(image, loop.instruction);
+        }
+
+        write(image, inputs.size());
+        for (number value : inputs)
+            writeValue(image, value);
+
+        bool ended = current_line == program->end();
+        write(image, (size_t)(ended ? 1 : 0));
+        if (!ended)
+        {
+            write(image, current_line->first);
+            write(image, pending.channel ? pending.statement : current_instruction);
+        }
+
+        write(image, executed);
+        write(image, data_cursor);
+        write(image, (size_t)(waiting && !blocked ? 1 : 0)); // a blocked SEND or RECV is simply run again
+
+        write(image, failure.size());
+        image.insert(image.end(), failure.begin(), failure.end());
+
+        return image;
+    }
+
+    // restores an image taken on a machine running the same program, see load()
+    // everything is read and checked before the machine is changed, a rejected image leaves it as it was
+    void restore(const vector<uint8_t>& image)
+    {
+        size_t at = 5;
+        if (image.size() < at || image[0] != 'T' || image[1] != 'B' || image[2] != 'S' || image[3] != 3 || image[4] != sizeof(number))
+            throw invalid_argument("not a snapshot of this machine");
+
+        size_t used = read(image, at);
+        if (used > VariableSet::size)
+            throw invalid_argument("too many variables in snapshot");
+        vector<number> values(used);
+        for (number& value : values)
+            value = readValue(image, at);
+
+        vector<number> saved_temporaries(read(image, at));
+        if (saved_temporaries.size() != temporaries.size())
+            throw invalid_argument("snapshot of another program");
+        for (number& value : saved_temporaries)
+            value = readValue(image, at);
+
+        vector<aligned_array<number>> saved_arrays(readCount(image, at, 1));
+        for (auto& array : saved_arrays)
+        {
+            array.resize(readCount(image, at, sizeof(number)));
+            for (size_t i = 0; i < array.size(); i++)
+                array[i] = readValue(image, at);
+        }
+
+
+        vector<number> operands(read(image, at));
+        if (operands.size() > stack.capacity())
+            throw invalid_argument("stack deeper than the program");
+        for (number& value : operands)
+            value = readValue(image, at);
+
+        vector<pair<typename Program::const_iterator, size_t>> saved_returns(readCount(image, at, 2));
+        for (auto& r : saved_returns)
+        {
+            r.first = readLine(image, at);
+            r.second = readPosition(image, at, r.first, 0);
+        }
+
+        vector<Loop> saved_loops(readCount(image, at, 3 + 2 * sizeof(number)));
+        for (Loop& loop : saved_loops)
+        {
+            loop.variable = read(image, at);
+            if (loop.variable >= VariableSet::size)
+                throw invalid_argument("invalid variable in snapshot");
+            loop.limit = readValue(image, at);
+            loop.step = readValue(image, at);
+            loop.line = readLine(image, at);
+            loop.instruction = readPosition(image, at, loop.line, 0);
+        }
+
+        deque<number> saved_inputs(readCount(image, at, sizeof(number)));
+        for (number& value : saved_inputs)
+            value = readValue(image, at);
+
+        typename Program::const_iterator line = program->end();
+        size_t instruction = 0;
+        if (!read(image, at))
+        {
+            line = readLine(image, at);
+            instruction = readPosition(image, at, line, operands.size());
+        }
+
+        // the unchecked accesses were compiled for the sizes DIM gives, the DIM of the preamble still to run gives them again
+        set<size_t> sized;
+        if (line == program->begin())
+        {
+            const InstructionSet& preamble = line->second;
+            for (size_t i = instruction; i < preamble.size() && preamble.next(i) != 0; i = extent(preamble, i))
+            {
+                size_t array = i + 1;
+                if (preamble.op(i) == instruction::dim)
+                    sized.insert(preamble.read(array));
+            }
+        }
+
+        for (auto& size : array_sizes)
+        {
+            if (!sized.count(size.first) && (size.first >= saved_arrays.size() || saved_arrays[size.first].size() < size.second))
+                throw invalid_argument("array smaller than its DIM in snapshot");
+        }
+
+        size_t saved_executed = read(image, at);
+        size_t cursor = read(image, at);
+        bool paused = read(image, at) != 0;
+
+        size_t length = read(image, at);
+        if (length > image.size() - at)
+            throw invalid_argument("truncated snapshot");
+        string message(image.begin() + at, image.begin() + at + length);
+
+        fill(begin(variables), end(variables), (number)0);
+        copy(values.begin(), values.end(), begin(variables));
+        temporaries = move(saved_temporaries);
+        arrays = move(saved_arrays);
+
+        stack.clear();
+        for (number value : operands)
+            stack.push(value);
+
+        returns = move(saved_returns);
+        loops = move(saved_loops);
+        inputs = move(saved_inputs);
+
+        current_line = line;
+        current_instruction = instruction;
+        executed = saved_executed;
+        data_cursor = cursor;
+        waiting = paused;
+        blocked = false;
+        pending = Pending();
+        failure = move(message);
+    }
+
+private:
+
+    // sizes and positions are written as variable length integers, numbers as their bytes
+    static void write(vector<uint8_t>& image, size_t value)
+    {
+        while (value >= 0x80)
+        {
+            image.push_back((uint8_t)(value | 0x80));
+            value >>= 7;
+        }
+        image.push_back((uint8_t)value);
+    }
+
+    static void writeValue(vector<uint8_t>& image, number value)
+    {
+        uint8_t bytes[sizeof(number)];
+        memcpy(bytes, &value, sizeof(number));
+        image.insert(image.end(), bytes, bytes + sizeof(number));
+    }
+
+    static size_t read(const vector<uint8_t>& image, size_t& at)
+    {
+        size_t value = 0;
+        for (size_t shift = 0; ; shift += 7)
+        {
+            if (at >= image.size() || shift >= 64)
+                throw invalid_argument("truncated snapshot");
+
+            uint8_t byte = image[at++];
+            value |= (size_t)(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+    }
+
+    static number readValue(const vector<uint8_t>& image, size_t& at)
+    {
+        if (at + sizeof(number) > image.size())
+            throw invalid_argument("truncated snapshot");
+
+        number value;
+        memcpy(&value, &image[at], sizeof(number));
+        at += sizeof(number);
+        return value;
+    }
+
+    typename Program::const_iterator readLine(const vector<uint8_t>& image, size_t& at) const
+    {
+        auto line = program->find(read(image, at));
+        if (line == program->end())
+            throw invalid_argument("snapshot of another program");
+        return line;
+    }
+
+    // a number of items of at least bytes each, no more than what is left of the image can hold
+    static size_t readCount(const vector<uint8_t>& image, size_t& at, size_t bytes)
+    {
+        size_t n = read(image, at);
+        if (n > (image.size() - at) / bytes)
+            throw invalid_argument("truncated snapshot");
+        return n;
+    }
+
+    // where an instruction of the line starts, or its end
+    // a statement of the line, or its end, where the machine stops with depth values on the stack, as verifyProgram counts them
+    static size_t readPosition(const vector<uint8_t>& image, size_t& at, typename Program::const_iterator line, size_t depth)
+    {
+        size_t position = read(image, at);
+
+        const InstructionSet& set = line->second;
+        size_t i = 0, values = 0;
+        while (i < position && i < set.size())
+        {
+            instruction op = set.op(i);
+            if (op == instruction::jne || op == instruction::pop)
+                values--;
+            else if (returnsValue(op))
+                values++;
+
+            size_t next = op == instruction::jne || op == instruction::pop ? set.next(i) : extent(set, i);
+            if (next == 0)
+                break;
+            i = next;
+        }
+
+        if (i != position)
+            throw invalid_argument("position out of its line in snapshot");
+        if (values != depth)
+            throw invalid_argument("stack depth of another position in snapshot");
+        return position;
+    }
+
+public:
+
+    number operator[](size_t i) const { return stack[i]; }
+    number& operator[](size_t i) { return stack[i]; }
+
+    number top()
+    {
+        return stack.top();
+    }
+
+    // runs a whole program, INPUT reads from the console
+    void run(const Program& p)
+    {
+        load(p);
+
+#ifdef _DEBUG
+        LARGE_INTEGER s, e;
+        QueryPerformanceCounter(&s);
+#endif
+
+        for (status s; (s = step((size_t)-1)) == status::waiting || s == status::blocked; )
+        {
+            if (s == status::blocked)
+            {
+                this_thread::yield();
+                continue;
+            }
+
+            number value;
+
+            cout << "? ";
+            if (!(cin >> value))
+                break;
+
+            input(value);
+        }
+
+#ifdef _DEBUG
+        QueryPerformanceCounter(&e);
+        cout << e.QuadPart - s.QuadPart << endl;
+#endif
+    }
+};
+
+template<class number> class BasicParserResult
+{
+public:
+    typedef BasicInstructionSet<number> InstructionSet;
+
+private:
+    bool valid;
+    variant<size_t, number, string, InstructionSet> value;
+public:
+
+    BasicParserResult(bool b) { valid = b; }
+    operator bool() const { return valid; }
+
+    BasicParserResult(number d) { value = d; valid = true; }
+    operator number() const { return get<number>(value); }
+
+    BasicParserResult(size_t s) { value = s; valid = true; }
+    operator size_t() const { return get<size_t>(value); }
+
+    BasicParserResult(instruction i) { InstructionSet set; set.push(i); value = set; valid = true; }
+
+    BasicParserResult(InstructionSet is) { valid = true; value = is; }
+    operator InstructionSet() const { return get<InstructionSet>(value); }
+
+    BasicParserResult operator+(const BasicParserResult& b)
+    {
+        InstructionSet result = *this;
+        result += (InstructionSet)b;
+
+        return result;
+    }
+
+    BasicParserResult operator+(size_t s)
+    {
+        InstructionSet result = *this;
+        result.push_value(s);
+
+        return result;
+    }
+
+    BasicParserResult operator+(number d)
+    {
+        InstructionSet result = *this;
+        result.push_value(d);
+
+        return result;
+    }
+};
+
+template<class number> BasicParserResult<number> operator+(instruction i, const BasicParserResult<number>& r)
+{
+    BasicInstructionSet<number> result;
+    result.push(i);
+    result += (BasicInstructionSet<number>)r;
+
+    return result;
+}
+
+template<class number> BasicParserResult<number> operator+(instruction i, const BasicInstructionSet<number>& r)
+{
+    return i + BasicParserResult<number>(r);
+}
+
+// number of parameters of a host callable : function pointer, lambda or functor
+template<class F> struct callable_traits : callable_traits<decltype(&F::operator())> {};
+template<class R, class... A> struct callable_traits<R(*)(A...)> { static constexpr size_t arity = sizeof...(A); };
+template<class C, class R, class... A> struct callable_traits<R(C::*)(A...)> : callable_traits<R(*)(A...)> {};
+template<class C, class R, class... A> struct callable_traits<R(C::*)(A...) const> : callable_traits<R(*)(A...)> {};
+
+// trampoline generated for each bound callable type : unpacks the parameters and calls it directly
+template<class number, class F> struct HostFunction
+{
+    static constexpr size_t arity = callable_traits<F>::arity;
+
+    template<size_t... I> static number invoke(F& f, const number* args, index_sequence<I...>)
+    {
+        (void)args;
+
+        if constexpr (is_void_v<decltype(f(args[I]...))>)
+        {
+            f(args[I]...);
+            return (number)0;
+        }
+        else
+            return (number)f(args[I]...);
+    }
+
+    static number trampoline(void* context, const number* args)
+    {
+        return invoke(*(F*)context, args, make_index_sequence<arity>());
+    }
+};
+
+// a plain function taking an opaque context pointer as its first parameter
+template<class R, class... A> struct ContextFunction
+{
+    R(*f)(void*, A...);
+    void* context;
+
+    R operator()(A... args) const { return f(context, args...); }
+};
+
+// a constant table sorted by name and searched by halves, it points to the table and never copies it
+template<class T> struct NameTable
+{
+    const T* entries = nullptr;
+    size_t size = 0;
+
+    constexpr NameTable() {}
+    template<size_t N> constexpr NameTable(const T(&table)[N]) : entries(table), size(N) {}
+
+    const T* find(string_view name) const
+    {
+        const T* end = entries + size;
+        const T* found = lower_bound(entries, end, name, [](const T& entry, string_view n) { return entry.name < n; });
+        return found != end && found->name == name ? found : nullptr;
+    }
+
+    template<size_t N> static constexpr bool sorted(const T(&table)[N])
+    {
+        for (size_t i = 1; i < N; i++)
+        {
+            if (!(table[i - 1].name < table[i].name))
+                return false;
+        }
+        return true;
+    }
+};
+
+template<class number, class VariableSet> class BasicTinyBasic
+{
+public:
+    typedef BasicInstructionSet<number> InstructionSet;
+    typedef BasicParserResult<number> ParserResult;
+    typedef BasicVirtualMachine<number, VariableSet> VirtualMachine;
+    typedef typename VirtualMachine::Program Program;
+
+private:
+
+    map<size_t, InstructionSet> program;
+    map<size_t, string> source;
+
+    size_t nextvariable = -1;
+    size_t jump_sites = 0;  // GOTO and GOSUB each have their own cache in the machine
+    map<string, size_t> variables;
+    map<string, size_t> arrays;
+
+    map<size_t, LineProfile> last_profile; // of the last RUN PROFILE, for LIST CODE and EXPLAIN
+
+    string empty;
+    string& line = empty;
+    size_t seek = 0;
+
+    // statements, shared by every parser and searched by halves
+    struct Keyword
+    {
+        string_view name;
+        ParserResult(BasicTinyBasic::*parse)();
+    };
+
+    static const Keyword* findKeyword(string_view name)
+    {
+        static constexpr Keyword keywords[] = {
+            { "CALL", &BasicTinyBasic::parseCall },
+            { "DATA", &BasicTinyBasic::parseData },
+            { "DIM", &BasicTinyBasic::parseDim },
+            { "END", &BasicTinyBasic::parseEnd },
+            { "EXPLAIN", &BasicTinyBasic::parseExplain },
+            { "FOR", &BasicTinyBasic::parseFor },
+            { "GOSUB", &BasicTinyBasic::parseGosub },
+            { "GOTO", &BasicTinyBasic::parseGoto },
+            { "IF", &BasicTinyBasic::parseIf },
+            { "INPUT", &BasicTinyBasic::parseInput },
+            { "LET", &BasicTinyBasic::parseLet },
+            { "LIST", &BasicTinyBasic::parseList },
+            { "MAT", &BasicTinyBasic::parseMat },
+            { "NEXT", &BasicTinyBasic::parseNext },
+            { "PARALLEL", &BasicTinyBasic::parseParallel },
+            { "PRINT", &BasicTinyBasic::parsePrint },
+            { "READ", &BasicTinyBasic::parseRead },
+            { "RECV", &BasicTinyBasic::parseRecv },
+            { "RESTORE", &BasicTinyBasic::parseRestore },
+            { "RETURN", &BasicTinyBasic::parseReturn },
+            { "RUN", &BasicTinyBasic::parseRun },
+            { "SEND", &BasicTinyBasic::parseSend },
+        };
+        static_assert(NameTable<Keyword>::sorted(keywords), "keywords must be sorted by name");
+
+        return NameTable<Keyword>(keywords).find(name);
+    }
+
+public:
+    // builtins the virtual machine knows natively and commands implemented by a function of the machine
+    struct Builtin
+    {
+        string_view name;
+        size_t parameters;
+        instruction op;
+        bool parenthesis;
+    };
+
+    struct Command
+    {
+        string_view name;
+        size_t parameters;
+        void(*f)(VirtualMachine&);
+        bool parenthesis;
+    };
+
+protected:
+    // constant tables of a dialect, set by the constructor of a derived parser
+    NameTable<Builtin> builtins;
+    NameTable<Command> builtin_commands;
+
+public:
+
+    // extensions of this parser only, searched after the constant tables
+    map<string, tuple<size_t, void(*)(VirtualMachine&), bool>, less<>> functions;
+    map<string, tuple<size_t, void(*)(VirtualMachine&), bool>, less<>> commands;
+
+protected:
+
+    // builtins added to this parser only : name -> (number of parameters, opcode, parenthesis)
+    map<string, tuple<size_t, instruction, bool>, less<>> intrinsics;
+
+    // callables bound by the host : name -> (number of parameters, trampoline, context)
+    map<string, tuple<size_t, number(*)(void*, const number*), void*>, less<>> host_functions;
+    map<string, tuple<size_t, number(*)(void*, const number*), void*>, less<>> host_commands;
+    vector<shared_ptr<void>> host_objects;
+
+public:
+
+    // binds any callable taking numbers, its number of parameters is deduced from its signature
+    template<class F> void bindFunction(const string& name, F f)
+    {
+        host_functions[name] = bind(move(f));
+    }
+
+    template<class R, class... A> void bindFunction(const string& name, R(*f)(void*, A...), void* context)
+    {
+        bindFunction(name, ContextFunction<R, A...>{ f, context });
+    }
+
+    // commands are used as statements, without parenthesis, and may return void
+    template<class F> void bindCommand(const string& name, F f)
+    {
+        host_commands[name] = bind(move(f));
+    }
+
+    template<class R, class... A> void bindCommand(const string& name, R(*f)(void*, A...), void* context)
+    {
+        bindCommand(name, ContextFunction<R, A...>{ f, context });
+    }
+
+    void parseLine(const string& aline)
+    {
+        line = aline;
+        parse();
+    }
+
+    int loop()
+    {
+        cout << "Tiny Basic v0.1 by Fred Morales" << endl;
+
+        while (true)
+        {
+            getline(cin, line);
+
+            parse();
+        }
+
+        return true;
+    }
+
+    int run()
+    {
+        VirtualMachine vm;
+        return run(vm);
+    }
+
+    int run(VirtualMachine& vm)
+    {
+        cout << "Tiny Basic v0.1 by Fred Morales" << endl;
+
+        vm.run(*compile());
+
+        return true;
+    }
+
+    // prepares a machine to run the program in slices
+    void load(VirtualMachine& vm)
+    {
+        vm.load(compile());
+    }
+
+    // the compiled code of a line, or of every line when line is -1, as a tree of instructions with the names of the
+    // variables, arrays and callbacks, and what each line costs : its instructions, and what a profile measured
+    // (see BasicVirtualMachine::profile, the lines of the profile are those of compile())
+    string explain(size_t line = (size_t)-1, const map<size_t, LineProfile>& profile = {})
+    {
+        shared_ptr<const Program> code = compile();
+
+        uint64_t total = 0;
+        for (auto& p : profile)
+            total += p.second.nanoseconds;
+
+        ostringstream out;
+
+        for (auto& l : *code)
+        {
+            if ((line != (size_t)-1 && l.first != line) || (l.first == 0 && l.second.size() == 0))
+                continue;
+
+            const InstructionSet& set = l.second;
+
+            auto text = source.find(l.first);
+            if (l.first == 0)
+                out << "0 (before the first line)" << endl;
+            else if (text != source.end())
+                out << l.first << ' ' << text->second << endl;
+            else
+                out << l.first << " (added by the compiler)" << endl;
+
+            disassemble(out, set, 0, set.size(), 1);
+
+            size_t instructions = 0;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+                instructions++;
+
+            out << "    cost: " << instructions << (instructions == 1 ? " instruction" : " instructions");
+
+            auto p = profile.find(l.first);
+            if (p != profile.end() && p->second.runs > 0)
+            {
+                const LineProfile& cost = p->second;
+                out << ", ran " << cost.runs << (cost.runs == 1 ? " time, " : " times, ") << cost.instructions << " dispatched, "
+                    << cost.nanoseconds << " ns, " << cost.nanoseconds / cost.runs << " ns per run";
+                if (total > 0)
+                    out << ", " << 100 * cost.nanoseconds / total << "% of the time";
+            }
+            out << endl;
+        }
+
+        if (line != (size_t)-1 && !code->count(line))
+            out << "no line " << line << endl;
+
+        return out.str();
+    }
+
+    // immutable copy of the program that any number of machines can share
+    shared_ptr<const Program> compile()
+    {
+        optimize();
+
+        // removals depend on the whole program, they are made on the copy so that lines can still be changed
+        shared_ptr<Program> compiled = make_shared<Program>(program);
+        gatherData(*compiled);
+        removeDeadStores(*compiled);
+        hoistInvariants(*compiled);
+
+        return compiled;
+    }
+
+private:
+
+    // the values of every DATA line in one segment at the end of line 0, which the machines read in place
+    // the DATA lines are left empty so that they can still be jumped to, RESTORE gets the position of its line
+    static void gatherData(Program& code)
+    {
+        InstructionSet values;
+        size_t count = 0;
+        map<size_t, size_t> positions; // line -> position of its first value
+
+        for (auto& l : code)
+        {
+            positions[l.first] = count;
+
+            InstructionSet& set = l.second;
+            if (set.size() == 0 || set.op(0) != instruction::data)
+                continue;
+
+            size_t at = 1;
+            count += set.read(at);
+            values += set.slice(at, set.size());
+            set = InstructionSet();
+        }
+
+        for (auto& l : code)
+        {
+            InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::restore)
+                {
+                    auto position = positions.lower_bound(set.readWord(at));
+                    set.patchWord(i + 1, position == positions.end() ? count : position->second);
+                }
+            }
+        }
+
+        if (count > 0)
+            code[0] += ParserResult(instruction::data) + count + values;
+    }
+
+    // whole program pass run before execution, it can be run again after lines are changed
+    void optimize()
+    {
+        map<size_t, number> sizes = arraySizes();
+
+        // arrays of known size are allocated before the first line so that their accesses can be checked at compile time
+        InstructionSet preamble;
+        for (auto& size : sizes)
+            preamble += ParserResult(instruction::dim) + size.first + (ParserResult(instruction::push) + size.second);
+        program[0] = preamble;
+
+        // per line, the loop variables whose range is known there : variable -> (lowest, highest)
+        map<size_t, map<size_t, pair<number, number>>> ranges = loopRanges(resolveLoops());
+
+        for (auto& l : program)
+        {
+            InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                instruction op = set.op(i);
+                if (op == instruction::getarr || op == instruction::getarr_unchecked || op == instruction::setarr || op == instruction::setarr_unchecked)
+                {
+                    bool get = op == instruction::getarr || op == instruction::getarr_unchecked;
+                    bool safe = false;
+
+                    size_t at = i + 1;
+                    auto size = sizes.find(set.read(at));
+                    if (size != sizes.end())
+                    {
+                        pair<number, number> index(-1, -1);
+
+                        instruction operand = set.op(at++);
+                        if (operand == instruction::push)
+                        {
+                            number value = set.value(at);
+                            index = { value, value };
+                        }
+                        else if (operand == instruction::getvar)
+                        {
+                            size_t variable = set.read(at);
+                            if (ranges[l.first].count(variable))
+                                index = ranges[l.first][variable];
+                        }
+
+                        safe = index.first >= 0 && index.second <= size->second;
+                    }
+
+                    if (safe)
+                        set.patch(i, get ? instruction::getarr_unchecked : instruction::setarr_unchecked);
+                    else
+                        set.patch(i, get ? instruction::getarr : instruction::setarr);
+                }
+            }
+        }
+    }
+
+    // sizes of the arrays that are only dimensioned with constants, the smallest one wins
+    map<size_t, number> arraySizes()
+    {
+        map<size_t, number> sizes;
+        set<size_t> dynamic;
+
+        for (auto& l : program)
+        {
+            InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                if (set.op(i) == instruction::dim)
+                {
+                    size_t at = i + 1;
+                    size_t array = set.read(at);
+
+                    number value = -1;
+                    if (set.op(at++) == instruction::push)
+                        value = set.value(at);
+
+                    if (value >= 0)
+                    {
+                        auto size = sizes.find(array);
+                        if (size == sizes.end() || value < size->second)
+                            sizes[array] = value;
+                    }
+                    else
+                        dynamic.insert(array);
+                }
+            }
+        }
+
+        for (size_t array : dynamic)
+            sizes.erase(array);
+
+        return sizes;
+    }
+
+    // pairs each FOR with the NEXT that closes it and stores the line of that NEXT in the FOR : FOR line -> NEXT line
+    map<size_t, size_t> resolveLoops()
+    {
+        map<size_t, size_t> loops;
+        vector<pair<size_t, size_t>> open; // (variable, line)
+
+        for (auto& l : program)
+        {
+            InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::forloop || set.op(i) == instruction::parallel)
+                {
+                    size_t variable = set.read(at);
+                    set.patchWord(at, 0);
+                    open.push_back({ variable, l.first });
+                }
+                else if (set.op(i) == instruction::next)
+                {
+                    size_t variable = set.read(at);
+                    while (!open.empty() && variable != (size_t)-1 && open.back().first != variable)
+                        open.pop_back();
+
+                    if (!open.empty())
+                    {
+                        loops[open.back().second] = l.first;
+                        open.pop_back();
+                    }
+                }
+            }
+        }
+
+        for (auto& loop : loops)
+        {
+            InstructionSet& set = program[loop.first];
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::forloop || set.op(i) == instruction::parallel)
+                {
+                    set.read(at);
+                    set.patchWord(at, loop.second);
+                }
+            }
+        }
+
+        return loops;
+    }
+
+    // range of the variable of each FOR with constant bounds, on the lines of its body, when nothing else can change it
+    map<size_t, map<size_t, pair<number, number>>> loopRanges(const map<size_t, size_t>& loops)
+    {
+        map<size_t, map<size_t, pair<number, number>>> ranges;
+
+        // jumps to a computed line can land anywhere
+        vector<pair<size_t, size_t>> jumps; // (from, to)
+        for (auto& l : program)
+        {
+            const InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                instruction op = set.op(i);
+                if (op == instruction::got || op == instruction::gosub)
+                {
+                    size_t at = set.next(i);
+                    if (set.op(at++) != instruction::push)
+                        return ranges;
+
+                    jumps.push_back({ l.first, (size_t)set.value(at) });
+                }
+            }
+        }
+
+        for (auto& loop : loops)
+        {
+            // FOR with three constants and nothing else on its line
+            const InstructionSet& header = program[loop.first];
+            if (header.op(0) != instruction::forloop)
+                continue;
+
+            size_t at = 1;
+            size_t variable = header.read(at);
+            header.readWord(at);
+
+            number bounds[3] = {};
+            bool constant = true;
+            for (number& bound : bounds)
+            {
+                constant = constant && at < header.size() && header.op(at) == instruction::push;
+                if (constant)
+                {
+                    at++;
+                    bound = header.value(at);
+                }
+            }
+
+            number start = bounds[0], limit = bounds[1], step = bounds[2];
+            if (!constant || at != header.size() || step == 0)
+                continue;
+
+            bool safe = true;
+
+            // the body is entered only through the FOR line
+            for (auto& jump : jumps)
+            {
+                bool inside = jump.first > loop.first && jump.first < loop.second;
+                if (jump.second > loop.first && jump.second <= loop.second && !inside)
+                    safe = false;
+            }
+
+            auto first = program.upper_bound(loop.first), last = program.find(loop.second);
+            for (auto l = first; safe && l != last; l++)
+            {
+                const InstructionSet& set = l->second;
+                for (size_t i = 0; safe && i < set.size(); i = set.next(i))
+                {
+                    size_t at = i + 1;
+                    switch (set.op(i))
+                    {
+                    case instruction::setvar:
+                    case instruction::input:
+                    case instruction::recv:
+                    case instruction::read:
+                    case instruction::forloop:
+                    case instruction::parallel:
+                    case instruction::next:
+                        safe = set.read(at) != variable;
+                        break;
+
+                    // subroutines and callbacks can change any variable
+                    case instruction::gosub:
+                    case instruction::call:
+                    case instruction::call_proc:
+                    case instruction::call_host:
+                    case instruction::call_host_proc:
+                        safe = false;
+                        break;
+
+                    default:
+                        break;
+                    }
+                }
+            }
+
+            if (safe)
+            {
+                for (auto l = first; l != last; l++)
+                    ranges[l->first][variable] = step > 0 ? make_pair(start, limit) : make_pair(limit, start);
+            }
+        }
+
+        return ranges;
+    }
+
+    typedef bitset<VariableSet::size> VariableMask;
+
+    // what the flow analysis knows of a line : where it can go and which variables it reads and always writes
+    struct Flow
+    {
+        set<size_t> successors;     // lines, or exit
+        bool anywhere = false;      // a computed GOTO or GOSUB can reach any line
+        bool returns = false;       // RETURN goes back after any GOSUB
+        VariableMask uses;
+        VariableMask defs;
+    };
+
+    static constexpr size_t exit_line = (size_t)-1;
+
+    // control flow graph of the program : each line is a block, its edges follow fall through, IF, GOTO, GOSUB, RETURN, FOR and NEXT
+    // callbacks and INPUT let the host see every variable, so do the end of the program, END and the statements that can fail
+    static map<size_t, Flow> flowGraph(const Program& code)
+    {
+        map<size_t, Flow> graph;
+
+        // NEXT line -> FOR line, from the NEXT lines stored in the FOR instructions
+        map<size_t, size_t> loops;
+        for (auto& l : code)
+        {
+            const InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::forloop || set.op(i) == instruction::parallel)
+                {
+                    set.read(at);
+                    if (size_t next = set.readWord(at))
+                        loops[next] = l.first;
+                }
+            }
+        }
+
+        for (auto l = code.begin(); l != code.end(); l++)
+        {
+            const InstructionSet& set = l->second;
+            Flow& flow = graph[l->first];
+
+            auto following = [&](size_t line)
+            {
+                auto n = code.upper_bound(line);
+                return n == code.end() ? exit_line : n->first;
+            };
+
+            // a jump to a constant line, or anywhere
+            auto target = [&](size_t i)
+            {
+                size_t at = set.next(i);
+                if (set.op(at++) == instruction::push)
+                    flow.successors.insert((size_t)set.value(at));
+                else
+                {
+                    flow.anywhere = true;
+                    flow.successors.insert(exit_line);
+                }
+            };
+
+            bool falls = true;
+            size_t guarded = 0; // end of the statements under an IF
+
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                bool always = i >= guarded;
+                size_t at = i + 1;
+
+                switch (set.op(i))
+                {
+                case instruction::jne:
+                    guarded = max(guarded, set.next(i) + set.read(at));
+                    break;
+
+                case instruction::getvar:
+                    flow.uses.set(set.read(at));
+                    break;
+
+                case instruction::setvar:
+                    if (always)
+                        flow.defs.set(set.read(at));
+                    break;
+
+                // the host can look at the variables while the machine waits
+                case instruction::input:
+                case instruction::recv:
+                    flow.uses.set();
+                    if (always)
+                        flow.defs.set(set.read(at));
+                    if (set.op(i) == instruction::recv)
+                        flow.successors.insert(exit_line); // unbound channel
+                    break;
+
+                // out of DATA
+                case instruction::read:
+                    if (always)
+                        flow.defs.set(set.read(at));
+                    flow.successors.insert(exit_line);
+                    break;
+
+                case instruction::mat_read:
+                    flow.successors.insert(exit_line);
+                    break;
+
+                case instruction::send:
+                    flow.uses.set();
+                    flow.successors.insert(exit_line);
+                    break;
+
+                case instruction::call:
+                case instruction::call_proc:
+                case instruction::call_host:
+                case instruction::call_host_proc:
+                    flow.uses.set();
+                    break;
+
+                case instruction::getarr:
+                case instruction::setarr:
+                case instruction::dim:
+                case instruction::mat_binary:
+                case instruction::mat_scalar:
+                case instruction::mat_function:
+                case instruction::mat_dot:
+                    flow.successors.insert(exit_line);
+                    break;
+
+                case instruction::div:
+                    if (is_integral_v<number>)
+                        flow.successors.insert(exit_line);
+                    break;
+
+                // a PARALLEL FOR is analysed as the FOR it is equivalent to, a reduction reads the value before the loop
+                case instruction::forloop:
+                case instruction::parallel:
+                {
+                    size_t variable = set.read(at);
+                    if (always)
+                        flow.defs.set(variable);
+                    if (size_t next = set.readWord(at))
+                        flow.successors.insert(following(next));
+                    if (set.op(i) == instruction::parallel)
+                        flow.successors.insert(exit_line); // STEP 0 or an error in the body
+                    break;
+                }
+
+                case instruction::reduce:
+                    set.read(at);
+                    flow.uses.set(set.read(at));
+                    break;
+
+                case instruction::next:
+                {
+                    size_t variable = set.read(at);
+                    if (variable == (size_t)-1)
+                        flow.uses.set();
+                    else
+                        flow.uses.set(variable);
+
+                    auto loop = loops.find(l->first);
+                    if (loop != loops.end())
+                        flow.successors.insert(following(loop->second));
+                    else
+                        flow.anywhere = true;
+                    flow.successors.insert(exit_line); // without FOR
+                    break;
+                }
+
+                case instruction::got:
+                    target(i);
+                    falls = falls && !always;
+                    break;
+
+                case instruction::gosub:
+                    target(i);
+                    break;
+
+                case instruction::ret:
+                    flow.returns = true;
+                    flow.successors.insert(exit_line); // without GOSUB
+                    falls = falls && !always;
+                    break;
+
+                case instruction::end:
+                    flow.successors.insert(exit_line);
+                    falls = falls && !always;
+                    break;
+
+                default:
+                    break;
+                }
+            }
+
+            if (falls)
+                flow.successors.insert(following(l->first));
+        }
+
+        return graph;
+    }
+
+    // variables that can be read after each line before being written again
+    static map<size_t, VariableMask> liveness(const Program& code, const map<size_t, Flow>& graph)
+    {
+        VariableMask all;
+        all.set();
+
+        // where a RETURN can continue
+        set<size_t> sites;
+        for (auto& l : code)
+        {
+            const InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                if (set.op(i) == instruction::gosub)
+                {
+                    auto n = code.upper_bound(l.first);
+                    sites.insert(n == code.end() ? exit_line : n->first);
+                }
+            }
+        }
+
+        map<size_t, VariableMask> in, out;
+
+        auto live = [&](size_t line) { return line == exit_line ? all : in[line]; };
+
+        for (bool changed = true; changed; )
+        {
+            changed = false;
+
+            for (auto l = graph.rbegin(); l != graph.rend(); l++)
+            {
+                const Flow& flow = l->second;
+
+                VariableMask after;
+                if (flow.anywhere)
+                    after = all;
+                for (size_t s : flow.successors)
+                    after |= code.count(s) ? live(s) : all; // an undefined line stops the program
+                if (flow.returns)
+                    for (size_t s : sites)
+                        after |= live(s);
+
+                VariableMask before = flow.uses | (after & ~flow.defs);
+
+                if (before != in[l->first] || after != out[l->first])
+                {
+                    in[l->first] = before;
+                    out[l->first] = after;
+                    changed = true;
+                }
+            }
+        }
+
+        return out;
+    }
+
+    // expressions without effects : no callbacks, no RND, nothing that can fail
+    static bool pure(const InstructionSet& set, size_t from)
+    {
+        for (size_t i = from; i < set.size(); i = set.next(i))
+        {
+            switch (set.op(i))
+            {
+            case instruction::push:
+            case instruction::getvar:
+            case instruction::plus:
+            case instruction::minus:
+            case instruction::mult:
+            case instruction::eq:
+            case instruction::ne:
+            case instruction::gt:
+            case instruction::lt:
+            case instruction::ge:
+            case instruction::le:
+            case instruction::getarr_unchecked:
+                break;
+
+            case instruction::div:
+                if (is_integral_v<number>)
+                    return false;
+                break;
+
+            default:
+                if (set.op(i) < instruction::abs || set.op(i) > instruction::tan || set.op(i) == instruction::rnd)
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    // removes the LET lines whose value is always written again before being read, until none is left
+    static void removeDeadStores(Program& code)
+    {
+        for (bool removed = true; removed; )
+        {
+            removed = false;
+
+            map<size_t, VariableMask> out = liveness(code, flowGraph(code));
+
+            for (auto& l : code)
+            {
+                InstructionSet& set = l.second;
+                if (set.size() == 0 || set.op(0) != instruction::setvar)
+                    continue;
+
+                size_t at = 1;
+                size_t variable = set.read(at);
+
+                if (!out[l.first].test(variable) && pure(set, at))
+                {
+                    set = InstructionSet();
+                    removed = true;
+                }
+            }
+        }
+    }
+
+    static size_t extent(const InstructionSet& set, size_t i)
+    {
+        return VirtualMachine::extent(set, i);
+    }
+
+    // an expression that gives the same value everywhere in a loop : pure and reading none of the variables the loop changes
+    static bool invariant(const InstructionSet& set, size_t i, const VariableMask& changed)
+    {
+        size_t at = i + 1;
+        switch (set.op(i))
+        {
+        case instruction::push:
+            return true;
+
+        case instruction::getvar:
+            return !changed.test(set.read(at));
+
+        case instruction::plus:
+        case instruction::minus:
+        case instruction::mult:
+        case instruction::eq:
+        case instruction::ne:
+        case instruction::gt:
+        case instruction::lt:
+        case instruction::ge:
+        case instruction::le:
+            break;
+
+        case instruction::div:
+            if (is_integral_v<number>)
+                return false;
+            break;
+
+        default:
+            if (set.op(i) < instruction::abs || set.op(i) > instruction::tan || set.op(i) == instruction::rnd)
+                return false;
+        }
+
+        size_t j = set.next(i);
+        for (size_t n = VirtualMachine::operands(set.op(i), set, i); n > 0; n--)
+        {
+            if (!invariant(set, j, changed))
+                return false;
+            j = extent(set, j);
+        }
+
+        return true;
+    }
+
+    // an expression of whole numbers only, its sums and products are exact
+    static bool whole(const InstructionSet& set, size_t i, const VariableMask& variables)
+    {
+        size_t at = i + 1;
+        switch (set.op(i))
+        {
+        case instruction::push:
+        {
+            number value = set.value(at);
+            return value == floor(value);
+        }
+
+        case instruction::getvar:
+            return variables.test(set.read(at));
+
+        case instruction::plus:
+        case instruction::minus:
+        case instruction::mult:
+        {
+            size_t right = extent(set, set.next(i));
+            return whole(set, set.next(i), variables) && whole(set, right, variables);
+        }
+
+        default:
+            return false;
+        }
+    }
+
+    // variables that only ever hold whole numbers, whatever the number type
+    static VariableMask wholeVariables(const Program& code)
+    {
+        VariableMask variables;
+        variables.set();
+
+        if constexpr (is_integral_v<number>)
+            return variables;
+
+        for (bool changed = true; changed; )
+        {
+            changed = false;
+
+            for (auto& l : code)
+            {
+                const InstructionSet& set = l.second;
+                for (size_t i = 0; i < set.size(); i = set.next(i))
+                {
+                    size_t at = i + 1;
+                    size_t variable = (size_t)-1;
+                    bool exact = false;
+
+                    switch (set.op(i))
+                    {
+                    case instruction::setvar:
+                        variable = set.read(at);
+                        exact = whole(set, at, variables);
+                        break;
+
+                    // the start and the step, NEXT adds the step
+                    case instruction::forloop:
+                    case instruction::parallel:
+                    {
+                        variable = set.read(at);
+                        set.readWord(at);
+                        size_t step = extent(set, extent(set, at));
+                        exact = whole(set, at, variables) && whole(set, step, variables);
+                        break;
+                    }
+
+                    case instruction::input:
+                    case instruction::recv:
+                    case instruction::read:
+                        variable = set.read(at);
+                        break;
+
+                    case instruction::reduce:
+                        set.read(at);
+                        variable = set.read(at);
+                        break;
+
+                    // commands and functions get the whole machine
+                    case instruction::call:
+                    case instruction::call_proc:
+                        return VariableMask();
+
+                    default:
+                        continue;
+                    }
+
+                    if (!exact && variables.test(variable))
+                    {
+                        variables.reset(variable);
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        return variables;
+    }
+
+    // temporaries the compiler already took
+    static size_t usedTemporaries(const Program& code)
+    {
+        size_t used = 0;
+
+        for (auto& l : code)
+        {
+            const InstructionSet& set = l.second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                size_t at = i + 1;
+                if (set.op(i) == instruction::settemp)
+                    used = max(used, set.read(at) + 1);
+            }
+        }
+
+        return used;
+    }
+
+    // lines that GOTO or GOSUB name as a constant
+    static set<size_t> jumpTargets(const InstructionSet& set)
+    {
+        std::set<size_t> targets;
+
+        for (size_t i = 0; i < set.size(); i = set.next(i))
+        {
+            if (set.op(i) == instruction::got || set.op(i) == instruction::gosub)
+            {
+                size_t at = set.next(i);
+                if (set.op(at++) == instruction::push)
+                    targets.insert((size_t)set.value(at));
+            }
+        }
+
+        return targets;
+    }
+
+    // the lines of a loop, from its header to the line that jumps back to it
+    struct Loop
+    {
+        size_t header;
+        size_t last;
+    };
+
+    // loops closed by a backward GOTO, IF ... THEN GOTO or NEXT, the innermost first
+    static vector<Loop> findLoops(const Program& code, const map<size_t, Flow>& graph)
+    {
+        map<size_t, size_t> loops; // header -> last line
+
+        for (auto& f : graph)
+        {
+            for (size_t s : f.second.successors)
+            {
+                auto target = code.find(s);
+                if (s == exit_line || s > f.first || target == code.end() || target == code.begin())
+                    continue;
+
+                // NEXT goes back to the line after its FOR, the FOR is run once before the loop
+                size_t header = s;
+                const InstructionSet& before = prev(target)->second;
+                for (size_t i = 0; i < before.size(); i = before.next(i))
+                {
+                    size_t at = i + 1;
+                    if (before.op(i) == instruction::forloop || before.op(i) == instruction::parallel)
+                    {
+                        before.read(at);
+                        if (before.readWord(at) == f.first)
+                            header = prev(target)->first;
+                    }
+                }
+
+                loops[header] = max(loops[header], f.first);
+            }
+        }
+
+        vector<Loop> sorted;
+        for (auto& loop : loops)
+            sorted.push_back({ loop.first, loop.second });
+
+        stable_sort(sorted.begin(), sorted.end(), [](const Loop& a, const Loop& b) { return a.last - a.header < b.last - b.header; });
+        return sorted;
+    }
+
+    // copy of the instructions from i to end, the expressions found in replacements read from their temporary,
+    // the statements of after added behind the instruction at their position, and the lengths of IF computed again
+    static InstructionSet rewrite(const InstructionSet& set, size_t i, size_t end, const map<string, size_t, less<>>& replacements, const map<size_t, InstructionSet>& after)
+    {
+        InstructionSet result;
+
+        while (i < end)
+        {
+            if (set.op(i) == instruction::jne)
+            {
+                size_t at = i + 1;
+                size_t length = set.read(at);
+
+                InstructionSet statement = rewrite(set, at, at + length, replacements, after);
+                result += ParserResult(instruction::jne) + statement.size() + statement;
+
+                i = at + length;
+                continue;
+            }
+
+            size_t j = set.next(i);
+            result += set.slice(i, j);
+
+            for (size_t n = VirtualMachine::operands(set.op(i), set, i); n > 0; n--)
+                j = rewriteExpression(set, j, replacements, result);
+
+            auto statement = after.find(i);
+            if (statement != after.end())
+                result += statement->second;
+
+            i = j;
+        }
+
+        return result;
+    }
+
+    static size_t rewriteExpression(const InstructionSet& set, size_t i, const map<string, size_t, less<>>& replacements, InstructionSet& result)
+    {
+        size_t end = extent(set, i);
+
+        auto replacement = replacements.find(set.view(i, end));
+        if (replacement != replacements.end())
+        {
+            result += ParserResult(instruction::gettemp) + replacement->second;
+            return end;
+        }
+
+        size_t j = set.next(i);
+        result += set.slice(i, j);
+
+        for (size_t n = VirtualMachine::operands(set.op(i), set, i); n > 0; n--)
+            j = rewriteExpression(set, j, replacements, result);
+
+        return j;
+    }
+
+    // loop invariant code motion : the expressions of a loop that do not change in it are computed in a new line before
+    // its header, and an induction variable multiplied by a constant is kept in a temporary that grows with it
+    static void hoistInvariants(Program& code)
+    {
+        for (bool hoisted = true; hoisted; )
+        {
+            hoisted = false;
+
+            map<size_t, Flow> graph = flowGraph(code);
+
+            // a computed jump can enter a loop anywhere
+            for (auto& f : graph)
+            {
+                if (f.second.anywhere)
+                    return;
+            }
+
+            for (const Loop& loop : findLoops(code, graph))
+            {
+                if (hoistLoop(code, graph, loop))
+                {
+                    hoisted = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    static bool hoistLoop(Program& code, const map<size_t, Flow>& graph, const Loop& loop)
+    {
+        auto first = code.find(loop.header), end = code.upper_bound(loop.last);
+        if (first == code.begin())
+            return false;
+
+        // the new line, where the line before the header goes on ; a jump lands after the line before its target so it skips it
+        size_t preheader = loop.header - 1;
+        if (preheader <= prev(first)->first)
+            return false;
+
+        // the loop is only entered from the line before it, other lines can only leave it
+        for (auto& f : graph)
+        {
+            set<size_t> targets = jumpTargets(code.at(f.first));
+            if (targets.count(preheader))
+                return false;
+
+            if (f.first >= loop.header && f.first <= loop.last)
+                continue;
+
+            for (size_t s : f.second.successors)
+            {
+                if (s != exit_line && s > loop.header && s <= loop.last)
+                    return false;
+            }
+
+            if (targets.count(loop.header))
+                return false;
+        }
+
+        // what the loop changes, subroutines and callbacks can change anything
+        VariableMask changed;
+        map<size_t, size_t> definitions; // variable -> number of writes
+        for (auto l = first; l != end; l++)
+        {
+            const InstructionSet& set = l->second;
+            for (size_t i = 0; i < set.size(); i = set.next(i))
+            {
+                size_t at = i + 1;
+                switch (set.op(i))
+                {
+                case instruction::setvar:
+                case instruction::input:
+                case instruction::recv:
+                case instruction::read:
+                case instruction::forloop:
+                case instruction::next:
+                {
+                    size_t variable = set.read(at);
+                    if (variable == (size_t)-1)
+                        changed.set();
+                    else
+                    {
+                        changed.set(variable);
+                        definitions[variable]++;
+                    }
+                    break;
+                }
+
+                case instruction::gosub:
+                case instruction::call:
+                case instruction::call_proc:
+                case instruction::call_host:
+                case instruction::call_host_proc:
+                case instruction::parallel:
+                    return false;
+
+                default:
+                    break;
+                }
+            }
+        }
+
+        // induction variables : written once per pass by LET I=I+C, C a whole constant when the numbers are not integers
+        VariableMask exact = wholeVariables(code);
+        map<size_t, pair<number, pair<size_t, size_t>>> inductions; // variable -> (step, (line, position of the LET))
+        for (auto l = first; l != end; l++)
+        {
+            const InstructionSet& set = l->second;
+            for (size_t i = 0; i < set.size(); i = extent(set, i))
+            {
+                if (set.op(i) == instruction::jne)
+                    break; // the rest of the line is guarded
+
+                size_t at = i + 1;
+                if (set.op(i) != instruction::setvar)
+                    continue;
+
+                size_t variable = set.read(at);
+                instruction op = set.op(at++);
+                if ((op != instruction::plus && op != instruction::minus) || set.op(at++) != instruction::getvar || set.read(at) != variable || set.op(at++) != instruction::push)
+                    continue;
+
+                number step = set.value(at);
+                if (op == instruction::minus)
+                    step = -step;
+
+                if (definitions[variable] == 1 && exact.test(variable) && step == floor(step))
+                    inductions[variable] = { step, { l->first, i } };
+            }
+        }
+
+        // the largest invariant expressions, identical ones share a temporary, and the products of an induction variable
+        vector<pair<string, bool>> found; // (expression, product), in the order found
+        set<string, less<>> invariants;
+        map<string, size_t, less<>> products; // expression -> number of uses
+
+        function<size_t(const InstructionSet&, size_t)> search = [&](const InstructionSet& set, size_t i)
+        {
+            size_t e = extent(set, i);
+            string expression(set.view(i, e));
+
+            if (VirtualMachine::operands(set.op(i), set, i) > 0 && invariant(set, i, changed))
+            {
+                if (invariants.insert(expression).second)
+                    found.push_back({ expression, false });
+                return e;
+            }
+
+            if (set.op(i) == instruction::mult)
+            {
+                size_t left = set.next(i), right = extent(set, left);
+                if (set.op(left) == instruction::push)
+                    swap(left, right);
+
+                if (set.op(left) == instruction::getvar && set.op(right) == instruction::push)
+                {
+                    size_t at = left + 1, value = right + 1;
+                    number factor = set.value(value);
+                    if (inductions.count(set.read(at)) && factor == floor(factor))
+                    {
+                        if (products[expression]++ == 0)
+                            found.push_back({ expression, true });
+                        return e;
+                    }
+                }
+            }
+
+            size_t j = set.next(i);
+            for (size_t n = VirtualMachine::operands(set.op(i), set, i); n > 0; n--)
+                j = search(set, j);
+            return j;
+        };
+
+        for (auto l = first; l != end; l++)
+        {
+            const InstructionSet& set = l->second;
+            for (size_t i = 0; i < set.size(); i = extent(set, i))
+            {
+                // the bounds of the FOR that starts the loop are computed once anyway
+                if (l == first && set.op(i) == instruction::forloop)
+                    continue;
+
+                size_t j = set.next(i);
+                for (size_t n = VirtualMachine::operands(set.op(i), set, i); n > 0; n--)
+                    j = search(set, j);
+            }
+        }
+
+        // the values are kept in temporaries of the compiler, after those of the loops already done
+        size_t temporaries = usedTemporaries(code);
+        auto allocate = [&]()
+        {
+            return temporaries < VariableSet::size ? temporaries++ : (size_t)-1;
+        };
+
+        InstructionSet prelude;
+        map<string, size_t, less<>> replacements;
+        map<size_t, map<size_t, InstructionSet>> updates; // line -> position -> statements after it
+
+        for (auto& f : found)
+        {
+            // the addition of each pass costs as much as two products replaced
+            if (f.second && products[f.first] < 3)
+                continue;
+
+            size_t temporary = allocate();
+            if (temporary == (size_t)-1)
+                break;
+
+            InstructionSet expression = InstructionSet::bytes((const uint8_t*)f.first.data(), f.first.size());
+            prelude += ParserResult(instruction::settemp) + temporary + expression;
+            replacements[f.first] = temporary;
+
+            if (f.second)
+            {
+                // T=I*K before the loop, then T=T+C*K where I=I+C, T a temporary
+                size_t left = expression.next(0), right = extent(expression, left);
+                if (expression.op(left) == instruction::push)
+                    swap(left, right);
+
+                size_t at = left + 1, value = right + 1;
+
+                auto& induction = inductions[expression.read(at)];
+                number increment = induction.first * expression.value(value);
+
+                updates[induction.second.first][induction.second.second] += ParserResult(instruction::settemp) + temporary + (instruction::plus + (ParserResult(instruction::gettemp) + temporary) + (ParserResult(instruction::push) + increment));
+            }
+        }
+
+        if (prelude.size() == 0)
+            return false;
+
+        for (auto l = first; l != end; l++)
+            l->second = rewrite(l->second, 0, l->second.size(), replacements, updates[l->first]);
+
+        code[preheader] = prelude;
+        return true;
+    }
+
+    template<class F> tuple<size_t, number(*)(void*, const number*), void*> bind(F f)
+    {
+        shared_ptr<F> object = make_shared<F>(move(f));
+        host_objects.push_back(object);
+
+        return { HostFunction<number, F>::arity, &HostFunction<number, F>::trampoline, object.get() };
+    }
+
+    bool eol()
+    {
+        return seek >= line.size();
+    }
+
+    void eatBlank()
+    {
+        while (!eol() && (line[seek] == ' ' || line[seek] == '\t'))
+            seek++;
+    }
+
+    ParserResult parse()
+    {
+        seek = 0;
+
+        if (ParserResult num = parseNumber())
+        {
+            size_t s = seek;
+            if (ParserResult set = parseStatement())
+            {
+                number n = num;
+                program[(size_t)n] = set;
+                source[(size_t)n] = &line[s];
+            }
+            return true;
+        }
+        else
+        {
+            return parseStatement();
+        }
+
+        return false;
+    }
+
+    bool parse(char c)
+    {
+        if (line[seek] == c)
+        {
+            seek++;
+            return true;
+        }
+
+        return false;
+    }
+
+    bool parse(const string& string)
+    {
+        if (line.compare(seek, string.size(), string) != 0)
+            return false;
+
+        seek += string.size();
+
+        eatBlank();
+
+        return true;
+    }
+
+    ParserResult parseNumber()
+    {
+        if (!eol() && line[seek] >= '0' && line[seek] <= '9')
+        {
+            number num = (number)(line[seek] - (size_t)'0');
+
+            seek++;
+            while (!eol() && line[seek] >= '0' && line[seek] <= '9')
+            {
+                num = num * 10 + (line[seek] - (size_t)'0');
+
+                seek++;
+            }
+
+            eatBlank();
+
+            return num;
+        }
+
+        return false;
+    }
+
+    ParserResult parseStatement()
+    {
+        if (ParserResult statement = parseToken())
+        {
+            return statement;
+        }
+
+        return false;
+    }
+
+    ParserResult parseToken()
+    {
+        size_t i = seek;
+
+        if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+        {
+            seek++;
+            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+            {
+                seek++;
+            }
+
+            string_view f(line.data() + i, seek - i);
+
+            if (const Keyword* keyword = findKeyword(f))
+            {
+                eatBlank();
+                return (this->*keyword->parse)();
+            }
+            else
+            {
+                if (const Command* command = builtin_commands.find(f))
+                {
+                    eatBlank();
+                    return parseCommand(command->parameters, command->f, command->parenthesis, instruction::call_proc);
+                }
+
+                auto command = commands.find(f);
+                if (command != commands.end())
+                {
+                    eatBlank();
+                    return parseCommand(get<0>(command->second), get<1>(command->second), get<2>(command->second), instruction::call_proc);
+                }
+
+                auto host = host_commands.find(f);
+                if (host != host_commands.end())
+                {
+                    eatBlank();
+                    return parseHost(host->second, false, instruction::call_host_proc);
+                }
+             }
+        }
+
+        seek = i;
+        return false;
+    }
+
+    ParserResult parseFunction()
+    {
+        size_t i = seek;
+
+        if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+        {
+            seek++;
+            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+            {
+                seek++;
+            }
+
+            string_view f(line.data() + i, seek - i);
+
+            // SUM(A) and DOT(A,B) take whole arrays
+            if (f == "SUM" || f == "DOT")
+            {
+                eatBlank();
+                if (parse('('))
+                {
+                    eatBlank();
+                    if (ParserResult a = parseMatArray())
+                    {
+                        if (f == "SUM" && parse(')'))
+                        {
+                            eatBlank();
+                            return ParserResult(instruction::mat_sum) + (size_t)a;
+                        }
+
+                        if (f == "DOT" && parse(','))
+                        {
+                            eatBlank();
+                            ParserResult b = parseMatArray();
+                            if (b && parse(')'))
+                            {
+                                eatBlank();
+                                return ParserResult(instruction::mat_dot) + (size_t)a + (size_t)b;
+                            }
+                        }
+                    }
+                }
+
+                seek = i;
+                return false;
+            }
+
+            if (const Builtin* builtin = builtins.find(f))
+            {
+                eatBlank();
+                return parseArguments(builtin->parameters, builtin->parenthesis, builtin->op);
+            }
+
+            auto intrinsic = intrinsics.find(f);
+            if (intrinsic != intrinsics.end())
+            {
+                eatBlank();
+                return parseArguments(get<0>(intrinsic->second), get<2>(intrinsic->second), get<1>(intrinsic->second));
+            }
+
+            auto host = host_functions.find(f);
+            if (host != host_functions.end())
+            {
+                eatBlank();
+                return parseHost(host->second, get<0>(host->second) > 0, instruction::call_host);
+            }
+
+            auto function = functions.find(f);
+            if (function != functions.end())
+            {
+                eatBlank();
+                return parseFunction(get<0>(function->second), get<1>(function->second), get<2>(function->second));
+            }
+        }
+
+        seek = i;
+        return false;
+    }
+    // PRINT list : expressions and quoted strings separated by ',' (next zone of 8 columns) or ';' (nothing)
+    // a separator at the end keeps the line open, a single value and its newline is a single instruction
+    ParserResult parsePrint()
+    {
+        InstructionSet set;
+
+        eatBlank();
+        if (eol())
+            return ParserResult(instruction::print_end) + (size_t)1;
+
+        while (true)
+        {
+            InstructionSet item;
+
+            if (ParserResult text = parseString())
+                item = ParserResult(instruction::print_string) + (InstructionSet)text;
+            else if (ParserResult expression = parseExpression())
+                item = instruction::print_value + expression;
+            else
+                return false;
+
+            eatBlank();
+            if (eol())
+            {
+                if (item.op(0) == instruction::print_value)
+                    item.patch(0, instruction::print);
+                else
+                    item += ParserResult(instruction::print_end) + (size_t)1;
+
+                set += item;
+                return set;
+            }
+
+            set += item;
+
+            if (parse(','))
+                set += ParserResult(instruction::print_tab);
+            else if (!parse(';'))
+                return false;
+
+            eatBlank();
+            if (eol())
+            {
+                set += ParserResult(instruction::print_end) + (size_t)0;
+                return set;
+            }
+        }
+    }
+
+    // quoted text, stored in the line as its length and its characters
+    ParserResult parseString()
+    {
+        if (eol() || line[seek] != '"')
+            return false;
+
+        size_t end = line.find('"', seek + 1);
+        if (end == string::npos)
+            return false;
+
+        InstructionSet set;
+        set.push_string(line.substr(seek + 1, end - seek - 1));
+        seek = end + 1;
+
+        return set;
+    }
+
+    ParserResult parseInput()
+    {
+        InstructionSet set;
+
+        do
+        {
+            eatBlank();
+
+            if (ParserResult variable = parseVariable())
+                set += ParserResult(instruction::input) + (size_t)variable;
+            else
+                return false;
+        }
+        while (parse(','));
+
+        return set;
+    }
+
+    ParserResult parseIf()
+    {
+        if (ParserResult exp1 = parseExpression())
+        {
+            if (ParserResult op = parseRelop())
+            {
+                if (ParserResult exp2 = parseExpression())
+                {
+                    if (parse("THEN"))
+                    {
+                        if (ParserResult statement = parseStatement())
+                        {
+                            // DATA is not a statement that runs
+                            InstructionSet guarded = statement;
+                            if (guarded.size() > 0 && guarded.op(0) == instruction::data)
+                                return false;
+
+                            return op + exp1 + exp2 + instruction::jne + guarded.size() + statement;
+                        }
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+    ParserResult parseGoto()
+    {
+        if (ParserResult expression = parseExpression())
+        {
+            return ParserResult(instruction::got) + jump_sites++ + expression;
+        }
+        return false;
+    }
+
+    ParserResult parseGosub()
+    {
+        if (ParserResult expression = parseExpression())
+        {
+            return ParserResult(instruction::gosub) + jump_sites++ + expression;
+        }
+        return false;
+    }
+
+    ParserResult parseFor()
+    {
+        if (ParserResult variable = parseVariable())
+        {
+            if (parse('='))
+            {
+                eatBlank();
+
+                if (ParserResult start = parseExpression())
+                {
+                    if (parse("TO"))
+                    {
+                        if (ParserResult limit = parseExpression())
+                        {
+                            ParserResult step = ParserResult(instruction::push) + (number)1;
+
+                            if (parse("STEP"))
+                            {
+                                if (!(step = parseExpression()))
+                                    return false;
+                            }
+
+                            // the line of the matching NEXT is resolved by optimize()
+                            return ParserResult(instruction::forloop) + (size_t)variable + InstructionSet::word(0) + start + limit + step;
+                        }
+                    }
+                }
+            }
+        }
+
+        return false;
+    }
+
+    // PARALLEL FOR I=1 TO N [STEP S] [SUM V[,V...]] [MIN V[,V...]] [MAX V[,V...]]
+    ParserResult parseParallel()
+    {
+        if (!parse("FOR"))
+            return false;
+
+        ParserResult loop = parseFor();
+        if (!loop)
+            return false;
+
+        InstructionSet set = loop;
+        set.patch(0, instruction::parallel);
+
+        static const pair<const char*, reduction> kinds[] = { { "SUM", reduction::sum }, { "MIN", reduction::min }, { "MAX", reduction::max } };
+
+        for (bool found = true; found; )
+        {
+            found = false;
+            for (auto& kind : kinds)
+            {
+                if (parse(kind.first))
+                {
+                    do
+                    {
+                        eatBlank();
+
+                        ParserResult variable = parseVariable();
+                        if (!variable)
+                            return false;
+
+                        set += ParserResult(instruction::reduce) + (size_t)kind.second + (size_t)variable;
+                        eatBlank();
+                    }
+                    while (parse(','));
+
+                    found = true;
+                }
+            }
+        }
+
+        return set;
+    }
+
+    ParserResult parseNext()
+    {
+        if (ParserResult variable = parseVariable())
+        {
+            return ParserResult(instruction::next) + (size_t)variable;
+        }
+
+        return ParserResult(instruction::next) + (size_t)-1;
+    }
+
+    // SEND channel, expression
+    ParserResult parseSend()
+    {
+        if (ParserResult channel = parseExpression())
+        {
+            if (parse(','))
+            {
+                eatBlank();
+
+                if (ParserResult value = parseExpression())
+                    return ParserResult(instruction::send) + channel + value;
+            }
+        }
+
+        return false;
+    }
+
+    // RECV channel, variable
+    ParserResult parseRecv()
+    {
+        if (ParserResult channel = parseExpression())
+        {
+            if (parse(','))
+            {
+                eatBlank();
+
+                if (ParserResult variable = parseVariable())
+                    return ParserResult(instruction::recv) + (size_t)variable + channel;
+            }
+        }
+
+        return false;
+    }
+
+    // DATA value, value... : numbers with an optional sign, the compiler moves them to the data segment
+    ParserResult parseData()
+    {
+        InstructionSet values;
+        size_t count = 0;
+
+        do
+        {
+            eatBlank();
+
+            // from_chars takes no sign before a positive number, and takes inf and nan that PRINT could not give back
+            if (!eol() && line[seek] == '+' && (seek + 1 >= line.size() || line[seek + 1] != '-'))
+                seek++;
+
+            number value;
+            from_chars_result result = from_chars(line.data() + seek, line.data() + line.size(), value);
+            if (result.ec != errc() || !isfinite((double)value))
+                return false;
+
+            seek = result.ptr - line.data();
+            eatBlank();
+
+            values.push_value(value);
+            count++;
+        }
+        while (parse(','));
+
+        if (!eol())
+            return false;
+
+        return ParserResult(instruction::data) + count + values;
+    }
+
+    ParserResult parseRead()
+    {
+        InstructionSet set;
+
+        do
+        {
+            eatBlank();
+
+            if (ParserResult variable = parseVariable())
+                set += ParserResult(instruction::read) + (size_t)variable;
+            else
+                return false;
+        }
+        while (parse(','));
+
+        return set;
+    }
+
+    // RESTORE reads again from the first DATA line, RESTORE n from the first one at or after line n
+    ParserResult parseRestore()
+    {
+        size_t from = 0;
+        if (ParserResult num = parseNumber())
+            from = (size_t)(number)num;
+
+        return ParserResult(instruction::restore) + InstructionSet::word(from);
+    }
+
+    ParserResult parseReturn()
+    {
+        return instruction::ret;
+    }
+
+    ParserResult parseLet()
+    {
+        if (ParserResult array = parseArray())
+        {
+            if (ParserResult index = parseIndex())
+            {
+                if (!eol() && line[seek] == '=')
+                {
+                    seek++;
+                    eatBlank();
+
+                    if (ParserResult expression = parseExpression())
+                    {
+                        return ParserResult(instruction::setarr) + (size_t)array + index + expression;
+                    }
+                }
+            }
+        }
+        else if (ParserResult variable = parseVariable())
+        {
+            if (!eol() && line[seek] == '=')
+            {
                 seek++;
+                eatBlank();
+
+                if (ParserResult expression = parseExpression())
+                {
+                    return ParserResult(instruction::setvar) + (size_t)variable + expression;
+                }
+            }
+        }
+
+        return false;
+    }
+
+    ParserResult parseDim()
+    {
+        InstructionSet set;
+
+        do
+        {
+            eatBlank();
+
+            if (ParserResult array = parseArray())
+            {
+                if (ParserResult size = parseIndex())
+                {
+                    set += ParserResult(instruction::dim) + (size_t)array + size;
+                    continue;
+                }
+            }
+
+            return false;
+        }
+        while (parse(','));
+
+        return set;
+    }
+
+    // MAT A = B, MAT A = (X), MAT A = B op C, MAT A = B op (X), MAT A = (X) op B, MAT A = F(B), MAT READ A
+    // op is + - * /, arrays are named without parenthesis and a scalar is a number or an expression in parenthesis
+    ParserResult parseMat()
+    {
+        // each array is filled from the DATA with one copy
+        if (parse("READ "))
+        {
+            InstructionSet set;
+
+            do
+            {
+                eatBlank();
+
+                if (ParserResult array = parseMatArray())
+                    set += ParserResult(instruction::mat_read) + (size_t)array;
+                else
+                    return false;
+            }
+            while (parse(','));
+
+            return set;
+        }
+
+        ParserResult target = parseMatArray();
+        if (!target || !parse('='))
+            return false;
+
+        eatBlank();
+
+        // a builtin function of one parameter
+        size_t i = seek;
+        while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+            seek++;
+
+        string_view name(line.data() + i, seek - i);
+
+        tuple<size_t, instruction, bool> function = { 0, instruction::nop, false };
+        if (const Builtin* builtin = builtins.find(name))
+            function = { builtin->parameters, builtin->op, builtin->parenthesis };
+        else if (auto intrinsic = intrinsics.find(name); intrinsic != intrinsics.end())
+            function = intrinsic->second;
+
+        if (get<0>(function) == 1 && get<2>(function))
+        {
+            eatBlank();
+            if (parse('('))
+            {
+                eatBlank();
+                ParserResult array = parseMatArray();
+                if (array && parse(')'))
+                    return ParserResult(instruction::mat_function) + (size_t)get<1>(function) + (size_t)target + (size_t)array;
             }
+            return false;
+        }
+        seek = i;
+
+        ParserResult left = parseMatOperand();
+        if (!left)
+            return false;
+
+        instruction op;
+        switch (eol() ? '\0' : line[seek])
+        {
+        case '+': op = instruction::plus; break;
+        case '-': op = instruction::minus; break;
+        case '*': op = instruction::mult; break;
+        case '/': op = instruction::div; break;
+
+        default:
+            if (((InstructionSet)left).op(0) != instruction::nop)
+                return ParserResult(instruction::mat_scalar) + (size_t)instruction::nop + (size_t)target + (size_t)target + (size_t)0 + left;
+            return ParserResult(instruction::mat_function) + (size_t)instruction::nop + (size_t)target + matOperand(left);
+        }
+
+        seek++;
+        eatBlank();
+
+        ParserResult right = parseMatOperand();
+        if (!right)
+            return false;
+
+        bool left_array = ((InstructionSet)left).op(0) == instruction::nop;
+        bool right_array = ((InstructionSet)right).op(0) == instruction::nop;
+
+        if (left_array && right_array)
+            return ParserResult(instruction::mat_binary) + (size_t)op + (size_t)target + matOperand(left) + matOperand(right);
+        if (left_array)
+            return ParserResult(instruction::mat_scalar) + (size_t)op + (size_t)target + matOperand(left) + (size_t)0 + right;
+        if (right_array)
+            return ParserResult(instruction::mat_scalar) + (size_t)op + (size_t)target + matOperand(right) + (size_t)1 + left;
+
+        return false;
+    }
 
-            string f = line.substr(i, seek - i);
+    // an array is returned as a nop followed by its slot, a scalar as its expression
+    ParserResult parseMatOperand()
+    {
+        if (ParserResult num = parseNumber())
+        {
+            eatBlank();
+            return ParserResult(instruction::push) + (number)num;
+        }
 
-            auto function = instructions.find(f);
-            if (function != instructions.end())
+        if (parse('('))
+        {
+            eatBlank();
+            ParserResult expression = parseExpression();
+            if (expression && parse(')'))
             {
                 eatBlank();
-                return function->second(*this);
+                return expression;
             }
-            else
-            {
-                auto command = commands.find(f);
-                if (command != commands.end())
-                {
-                    eatBlank();
-                    return parseCommand(get<0>(command->second), get<1>(command->second), get<2>(command->second), instruction::call_proc);
-                }
-             }
+            return false;
         }
 
-        seek = i;
+        if (ParserResult array = parseMatArray())
+            return ParserResult(instruction::nop) + (size_t)array;
+
         return false;
     }
 
-    ParserResult parseFunction()
+    static size_t matOperand(const InstructionSet& operand)
+    {
+        size_t at = 1;
+        return operand.read(at);
+    }
+
+    // an array named without index
+    ParserResult parseMatArray()
     {
         size_t i = seek;
 
         if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
         {
             seek++;
-            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+
+            if constexpr (VariableSet::long_names)
             {
-                seek++;
+                while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+                {
+                    seek++;
+                }
             }
 
-            string f = line.substr(i, seek - i);
+            string a = line.substr(i, seek - i);
 
-            auto function = functions.find(f);
-            if (function != functions.end())
-            {
-                eatBlank();
-                return parseFunction(get<0>(function->second), get<1>(function->second), get<2>(function->second));
-            }
+            eatBlank();
+
+            auto array = arrays.find(a);
+            if (array != arrays.end())
+                return array->second;
+
+            size_t slot = arrays.size();
+            arrays[a] = slot;
+            return slot;
         }
 
-        seek = i;
         return false;
     }
-    ParserResult parsePrint()
+
+    static const char* mnemonic(instruction op)
     {
-        if (ParserResult expression = parseExpression())
+        static const char* names[] = {
+            "nop", "push", "pop", "jne", "plus", "minus", "mult", "div", "setvar", "getvar",
+            "goto", "gosub", "return", "end", "eq", "ne", "gt", "lt", "ge", "le",
+            "print", "input", "call", "call_proc", "abs", "acs", "asn", "atn", "cos", "exp",
+            "int", "ln", "log", "pi", "rnd", "sgn", "sin", "sqr", "tan", "call_host",
+            "call_host_proc", "dim", "getarr", "setarr", "getarr_unchecked", "setarr_unchecked", "for", "next", "print_value", "print_string",
+            "print_tab", "print_end", "parallel", "reduce", "mat_binary", "mat_scalar", "mat_function", "mat_sum", "mat_dot", "send",
+            "recv", "data", "read", "mat_read", "restore", "settemp", "gettemp",
+        };
+        static_assert(size(names) == (size_t)instruction::gettemp + 1, "a name for each instruction");
+
+        return (size_t)op < size(names) ? names[(size_t)op] : "?";
+    }
+
+    string variableName(size_t variable) const
+    {
+        if constexpr (!VariableSet::long_names)
         {
-            return instruction::print + expression;
+            if (variable < 26)
+                return string(1, (char)('A' + variable));
         }
-        return false;
+
+        for (auto& v : variables)
+        {
+            if (v.second == variable)
+                return v.first;
+        }
+
+        return "#" + to_string(variable); // a variable of the compiler
     }
 
-    ParserResult parseInput()
+    string arrayName(size_t array) const
     {
-        if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+        for (auto& a : arrays)
         {
-            size_t variable = (size_t)(line[seek] - (char)'A');
+            if (a.second == array)
+                return a.first;
+        }
 
-            seek++;
+        return "#" + to_string(array);
+    }
 
-            eatBlank();
+    // builtins by their opcode, callbacks by the address stored in the code
+    string functionName(instruction op) const
+    {
+        for (size_t b = 0; b < builtins.size; b++)
+        {
+            if (builtins.entries[b].op == op)
+                return string(builtins.entries[b].name);
+        }
 
-            return instruction::input + variable;
+        for (auto& i : intrinsics)
+        {
+            if (get<1>(i.second) == op)
+                return i.first;
         }
 
-        return false;
+        return mnemonic(op);
     }
 
-    ParserResult parseIf()
+    string callbackName(const InstructionSet& set, size_t i) const
     {
-        if (ParserResult exp1 = parseExpression())
+        size_t at = i + 1;
+        set.read(at);
+        size_t address = set.readWord(at);
+
+        if (set.op(i) == instruction::call_host || set.op(i) == instruction::call_host_proc)
         {
-            if (ParserResult op = parseRelop())
+            size_t context = set.readWord(at);
+            for (auto* hosts : { &host_functions, &host_commands })
             {
-                if (ParserResult exp2 = parseExpression())
+                for (auto& h : *hosts)
                 {
-                    if (parse("THEN"))
-                    {
-                        if (ParserResult statement = parseStatement())
-                        {
-                            return op + exp1 + exp2 + instruction::jne + ((InstructionSet)statement).size() + statement;
-                        }
-                    }
+                    if ((size_t)get<1>(h.second) == address && (size_t)get<2>(h.second) == context)
+                        return h.first;
                 }
             }
+            return "?";
         }
 
-        return false;
-    }
-
-    ParserResult parseGoto()
-    {
-        if (ParserResult expression = parseExpression())
+        for (size_t c = 0; c < builtin_commands.size; c++)
         {
-            return instruction::got + expression;
+            if ((size_t)builtin_commands.entries[c].f == address)
+                return string(builtin_commands.entries[c].name);
         }
-        return false;
-    }
 
-    ParserResult parseGosub()
-    {
-        if (ParserResult expression = parseExpression())
+        for (auto* callbacks : { &functions, &commands })
         {
-            return instruction::gosub + expression;
+            for (auto& c : *callbacks)
+            {
+                if ((size_t)get<1>(c.second) == address)
+                    return c.first;
+            }
         }
-        return false;
-    }
 
-    ParserResult parseReturn()
-    {
-        return instruction::ret;
+        return "?";
     }
 
-#ifdef ORIGINAL
-    ParserResult parseLet()
+    // one instruction per line, its operands below it, the statement under an IF one step further
+    void disassemble(ostream& out, const InstructionSet& set, size_t i, size_t end, size_t depth) const
     {
-        if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+        while (i < end && i < set.size())
         {
-            size_t variable = (size_t)line[seek] - (size_t)'A';
+            instruction op = set.op(i);
+            size_t at = i + 1;
 
-            seek++;
+            out << string(depth * 2 + 2, ' ');
 
-            eatBlank();
-            if (!eol() && line[seek] == '=')
+            switch (op)
             {
-                seek++;
-                eatBlank();
+            case instruction::push:
+                out << "push " << set.value(at);
+                break;
+
+            case instruction::setvar:
+            case instruction::getvar:
+            case instruction::input:
+            case instruction::read:
+                out << mnemonic(op) << ' ' << variableName(set.read(at));
+                break;
+
+            case instruction::settemp:
+            case instruction::gettemp:
+                out << mnemonic(op) << " #" << set.read(at);
+                break;
+
+            case instruction::data:
+            {
+                size_t count = set.read(at);
+                out << "data " << count << (count == 1 ? " value" : " values");
+                break;
+            }
 
-                if (ParserResult expression = parseExpression())
-                {
-                    return ParserResult(instruction::setvar) + variable + expression;
-                }
+            case instruction::restore:
+                out << "restore " << set.readWord(at);
+                break;
+
+            case instruction::recv:
+                out << "recv " << variableName(set.read(at));
+                break;
+
+            case instruction::got:
+            case instruction::gosub:
+                out << mnemonic(op) << " (site " << set.read(at) << ")";
+                break;
+
+            case instruction::call:
+            case instruction::call_proc:
+            case instruction::call_host:
+            case instruction::call_host_proc:
+                out << mnemonic(op) << ' ' << callbackName(set, i);
+                break;
+
+            case instruction::dim:
+            case instruction::getarr:
+            case instruction::setarr:
+            case instruction::getarr_unchecked:
+            case instruction::setarr_unchecked:
+            case instruction::mat_sum:
+            case instruction::mat_read:
+                out << mnemonic(op) << ' ' << arrayName(set.read(at));
+                break;
+
+            case instruction::mat_dot:
+            {
+                size_t a = set.read(at);
+                out << "mat_dot " << arrayName(a) << ' ' << arrayName(set.read(at));
+                break;
             }
-        }
 
-        return false;
-    }
-#else
-    ParserResult parseLet()
-    {
-        size_t i = seek;
+            case instruction::mat_binary:
+            case instruction::mat_scalar:
+            case instruction::mat_function:
+            {
+                instruction operation = (instruction)set.read(at);
+                size_t target = set.read(at);
+                size_t array = set.read(at);
+
+                out << mnemonic(op) << ' ' << (op == instruction::mat_function ? functionName(operation) : mnemonic(operation)) << ' ' << arrayName(target) << ' ' << arrayName(array);
+                if (op == instruction::mat_binary)
+                    out << ' ' << arrayName(set.read(at));
+                else if (op == instruction::mat_scalar && set.read(at))
+                    out << " (scalar first)";
+                break;
+            }
 
-        if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
-        {
-            seek++;
-            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+            case instruction::forloop:
+            case instruction::parallel:
             {
-                seek++;
+                size_t variable = set.read(at);
+                out << mnemonic(op) << ' ' << variableName(variable) << " (next at " << set.readWord(at) << ")";
+                break;
             }
 
-            string v = line.substr(i, seek - i);
+            case instruction::next:
+            {
+                size_t variable = set.read(at);
+                out << "next";
+                if (variable != (size_t)-1)
+                    out << ' ' << variableName(variable);
+                break;
+            }
 
-            eatBlank();
+            case instruction::reduce:
+            {
+                static const char* kinds[] = { "sum", "min", "max" };
+                size_t kind = set.read(at);
+                out << "reduce " << (kind < 3 ? kinds[kind] : "?") << ' ' << variableName(set.read(at));
+                break;
+            }
 
-            size_t variable = (size_t)-1;
+            case instruction::print_string:
+                out << "print_string \"" << set.text(at) << '"';
+                break;
 
-            auto i = variables.find(v);
-            if (i != variables.end())
-                variable = i->second;
-            else
+            case instruction::print_end:
+                out << (set.read(at) ? "print_end newline" : "print_end");
+                break;
+
+            // the statement the condition guards
+            case instruction::jne:
             {
-                nextvariable++;
-                variables[v] = nextvariable;
-                variable = nextvariable;
+                size_t length = set.read(at);
+                out << "jne" << endl;
+                disassemble(out, set, at, at + length, depth + 1);
+                i = at + length;
+                continue;
             }
 
-            eatBlank();
-            if (!eol() && line[seek] == '=')
-            {
-                seek++;
-                eatBlank();
+            default:
+                if (op >= instruction::abs && op <= instruction::tan)
+                    out << functionName(op);
+                else
+                    out << mnemonic(op);
+                break;
+            }
 
-                if (ParserResult expression = parseExpression())
-                {
-                    return ParserResult(instruction::setvar) + variable + expression;
-                }
+            out << endl;
+
+            // operands one step further
+            size_t j = set.next(i);
+            for (size_t n = VirtualMachine::operands(op, set, i); n > 0 && j; n--)
+            {
+                size_t e = extent(set, j);
+                disassemble(out, set, j, e, depth + 1);
+                j = e;
             }
-        }
 
-        return false;
+            if (!j)
+                break;
+            i = j;
+        }
     }
-#endif
 
     ParserResult parseList()
     {
+        if (parse("CODE"))
+        {
+            cout << explain((size_t)-1, last_profile);
+            return true;
+        }
+
         for (auto l : source)
         {
             cout << l.first << ' ' << l.second << endl;
@@ -892,11 +5999,26 @@ private:
         return parseFunction();
     }
 
+    // RUN PROFILE also times every line, for EXPLAIN, a plain RUN is not slowed down
     ParserResult parseRun()
     {
         VirtualMachine vm;
 
-        vm.run(program);
+        bool profiling = parse("PROFILE");
+        vm.profile(profiling);
+        vm.run(*compile());
+        last_profile = profiling ? vm.profiles() : map<size_t, LineProfile>();
+
+        return true;
+    }
+
+    // EXPLAIN n : the code of a line and what it cost in the last RUN PROFILE, EXPLAIN alone does every line
+    ParserResult parseExplain()
+    {
+        if (ParserResult n = parseNumber())
+            cout << explain((size_t)(number)n, last_profile);
+        else
+            cout << explain((size_t)-1, last_profile);
 
         return true;
     }
@@ -909,11 +6031,21 @@ private:
 
     ParserResult parseExpression()
     {
+        bool negate = false;
+        if (parse('-'))
+            negate = true;
+        else
+            parse('+');
+        eatBlank();
+
         if (ParserResult a = parseTerm())
         {
             InstructionSet set;
             set += a;
 
+            if (negate)
+                set = instruction::minus + (ParserResult(instruction::push) + (number)0) + set;
+
             bool loop = true;
 
 
@@ -922,22 +6054,24 @@ private:
                 loop = false;
                 if (parse('+'))
                 {
+                    eatBlank();
                     if (ParserResult b = parseTerm())
                     {
                         loop = true;
 
-                        return instruction::plus + set + b;
+                        set = instruction::plus + set + b;
                     }
                     else
                         return false;
                 }
                 else if (parse('-'))
                 {
+                    eatBlank();
                     if (ParserResult b = parseTerm())
                     {
                         loop = true;
 
-                        return instruction::minus + set + b;
+                        set = instruction::minus + set + b;
                     }
                     else
                         return false;
@@ -965,6 +6099,7 @@ private:
                 loop = false;
                 if (parse('*'))
                 {
+                    eatBlank();
                     if (ParserResult b = parseFactor())
                     {
                         loop = true;
@@ -977,11 +6112,12 @@ private:
                 }
                 else if (parse('/'))
                 {
+                    eatBlank();
                     if (ParserResult b = parseFactor())
                     {
                         loop = true;
 
-                        return instruction::plus + set + b;
+                        set = instruction::div + set + b;
                     }
                     else
                         return false;
@@ -1004,6 +6140,13 @@ private:
         {
             return function;
         }
+        else if (ParserResult array = parseArray())
+        {
+            if (ParserResult index = parseIndex())
+            {
+                return ParserResult(instruction::getarr) + (size_t)array + index;
+            }
+        }
         else if (ParserResult variable = parseVariable())
         {
             return ParserResult(instruction::getvar) + (size_t)variable;
@@ -1011,9 +6154,14 @@ private:
 
         else if (parse('('))
         {
-            if (ParserResult exp = parseExpression() && parse(')'))
+            eatBlank();
+            if (ParserResult exp = parseExpression())
             {
-                return exp;
+                if (parse(')'))
+                {
+                    eatBlank();
+                    return exp;
+                }
             }
         }
 
@@ -1082,58 +6230,115 @@ private:
         return false;
     }
 
-#ifdef ORIGINAL
     ParserResult parseVariable()
     {
+        size_t i = seek;
+
         if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
         {
-            size_t variable = (size_t)line[seek] - (size_t)'A';
             seek++;
 
+            if constexpr (!VariableSet::long_names)
+            {
+                eatBlank();
+
+                return (size_t)line[i] - (size_t)'A';
+            }
+
+            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+            {
+                seek++;
+            }
+
+            string v = line.substr(i, seek - i);
+
             eatBlank();
 
-            return variable;
+            auto i = variables.find(v);
+            if (i != variables.end())
+                return i->second;
+            else if (nextvariable + 1 < VariableSet::size)
+            {
+                nextvariable++;
+                variables[v] = nextvariable;
+                return nextvariable;
+            }
         }
 
         return false;
     }
-#else
-    ParserResult parseVariable()
+
+    // a name directly followed by a parenthesis, arrays have their own names and slots
+    ParserResult parseArray()
     {
         size_t i = seek;
 
         if (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
         {
             seek++;
-            while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+
+            if constexpr (VariableSet::long_names)
             {
-                seek++;
+                while (!eol() && line[seek] >= 'A' && line[seek] <= 'Z')
+                {
+                    seek++;
+                }
             }
 
-            string v = line.substr(i, seek - i);
+            string a = line.substr(i, seek - i);
 
             eatBlank();
 
-            auto i = variables.find(v);
-            if (i != variables.end())
-                return i->second;
-            else
+            if (!eol() && line[seek] == '(')
             {
-                nextvariable++;
-                variables[v] = nextvariable;
-                return nextvariable;
-            }            
+                auto array = arrays.find(a);
+                if (array != arrays.end())
+                    return array->second;
+
+                size_t slot = arrays.size();
+                arrays[a] = slot;
+                return slot;
+            }
+        }
+
+        seek = i;
+        return false;
+    }
+
+    ParserResult parseIndex()
+    {
+        if (parse('('))
+        {
+            eatBlank();
+
+            if (ParserResult index = parseExpression())
+            {
+                if (parse(')'))
+                {
+                    eatBlank();
+                    return index;
+                }
+            }
         }
 
         return false;
     }
-#endif
 
     ParserResult parseCommand(size_t parameters, void(*f)(VirtualMachine&), bool parenthesis, instruction inst)
     {
-        size_t i = seek;
+        return parseArguments(parameters, parenthesis, ParserResult(inst) + parameters + InstructionSet::word((size_t)f));
+    }
 
-        ParserResult set = ParserResult(inst) + parameters + (size_t)f;
+    ParserResult parseHost(const tuple<size_t, number(*)(void*, const number*), void*>& host, bool parenthesis, instruction inst)
+    {
+        size_t parameters = get<0>(host);
+
+        return parseArguments(parameters, parenthesis, ParserResult(inst) + parameters + InstructionSet::word((size_t)get<1>(host)) + InstructionSet::word((size_t)get<2>(host)));
+    }
+
+    ParserResult parseArguments(size_t parameters, bool parenthesis, ParserResult set)
+    {
+        size_t i = seek;
 
         eatBlank();
 
@@ -1187,34 +6392,68 @@ private:
     }
 };
 
-#ifndef ORIGINAL
-
-class ExtendedTinyBasic : public TinyBasic
+template<class number, class VariableSet = ExtendedVariables> class BasicExtendedTinyBasic : public BasicTinyBasic<number, VariableSet>
 {
 public:
-    ExtendedTinyBasic()
-    {
-        srand((unsigned int)time(nullptr));
-
-        commands["CLEAR"] = { 0, [](VirtualMachine& vm) { for (auto& v : vm.variables) v = (number)0; } , false };
-
-        functions["ABS"] = { 1, [](VirtualMachine& vm) { vm[1] = abs(vm[0]); }, true };
-        functions["ACS"] = { 1, [](VirtualMachine& vm) { vm[1] = acos(vm[0]); }, true };
-        functions["ASN"] = { 1, [](VirtualMachine& vm) { vm[1] = asin(vm[0]); }, true };
-        functions["ASN"] = { 1, [](VirtualMachine& vm) { vm[1] = asin(vm[0]); }, true };
-        functions["ATN"] = { 1, [](VirtualMachine& vm) { vm[1] = atan(vm[0]); }, true };
-        functions["COS"] = { 1, [](VirtualMachine& vm) { vm[1] = cos(vm[0]); }, true };
-        functions["EXP"] = { 1, [](VirtualMachine& vm) { vm[1] = exp(vm[0]); }, true };
-        functions["INT"] = { 1, [](VirtualMachine& vm) { vm[1] = floor(vm[0]); }, true };
-        functions["LN"] = { 1, [](VirtualMachine& vm) { vm[1] = log(vm[0]); }, true };
-        functions["LOG"] = { 1, [](VirtualMachine& vm) { vm[1] = log10(vm[0]); }, true };
-        functions["PI"] = { 0, [](VirtualMachine& vm) { vm[0] = 3.14159265358979323846; }, false };
-        functions["RND"] = { 1, [](VirtualMachine& vm) { vm[1] = (double)rand() / RAND_MAX; }, true };
-        functions["SGN"] = { 1, [](VirtualMachine& vm) { vm[1] = (vm[0] == 0.0 ? 0.0 : (vm[0] < 0.0 ? -1.0 : 1.0)); } , true };
-        functions["SIN"] = { 1, [](VirtualMachine& vm) { vm[1] = sin(vm[0]); }, true };
-        functions["SQR"] = { 1, [](VirtualMachine& vm) { vm[1] = sqrt(vm[0]); }, true };
-        functions["TAN"] = { 1, [](VirtualMachine& vm) { vm[1] = tan(vm[0]); }, true };
+    typedef BasicVirtualMachine<number, VariableSet> VirtualMachine;
+
+    BasicExtendedTinyBasic()
+    {
+        static bool seeded = (srand((unsigned int)time(nullptr)), true);
+        (void)seeded;
+
+        static constexpr typename BasicExtendedTinyBasic::Builtin builtins[] = {
+            { "ABS", 1, instruction::abs, true },
+            { "ACS", 1, instruction::acs, true },
+            { "ASN", 1, instruction::asn, true },
+            { "ATN", 1, instruction::atn, true },
+            { "COS", 1, instruction::cos, true },
+            { "EXP", 1, instruction::exp, true },
+            { "INT", 1, instruction::integer, true },
+            { "LN", 1, instruction::ln, true },
+            { "LOG", 1, instruction::log, true },
+            { "PI", 0, instruction::pi, false },
+            { "RND", 1, instruction::rnd, true },
+            { "SGN", 1, instruction::sgn, true },
+            { "SIN", 1, instruction::sin, true },
+            { "SQR", 1, instruction::sqr, true },
+            { "TAN", 1, instruction::tan, true },
+        };
+
+        static constexpr typename BasicExtendedTinyBasic::Command commands[] = {
+            { "CLEAR", 0, &clear, false },
+        };
+
+        static_assert(NameTable<typename BasicExtendedTinyBasic::Builtin>::sorted(builtins), "builtins must be sorted by name");
+        static_assert(NameTable<typename BasicExtendedTinyBasic::Command>::sorted(commands), "commands must be sorted by name");
+
+        this->builtins = builtins;
+        this->builtin_commands = commands;
+    }
+
+private:
+    static void clear(VirtualMachine& vm)
+    {
+        for (auto& v : vm.variables)
+            v = (number)0;
     }
 };
 
-#endif
\ No newline at end of file
+// ORIGINAL only selects which configuration the short names refer to, both can be used side by side
+
+#ifdef ORIGINAL
+typedef int number;
+typedef OriginalVariables Variables;
+#else
+typedef double number;
+typedef ExtendedVariables Variables;
+#endif
+
+typedef BasicInstructionSet<number> InstructionSet;
+typedef BasicParserResult<number> ParserResult;
+typedef BasicVirtualMachine<number, Variables> VirtualMachine;
+typedef BasicTinyBasic<number, Variables> TinyBasic;
+
+#ifndef ORIGINAL
+typedef BasicExtendedTinyBasic<number, Variables> ExtendedTinyBasic;
+#endif
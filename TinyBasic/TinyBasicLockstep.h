@@ -0,0 +1,945 @@
+#pragma once
+
+// lockstep execution of many instances of a Tiny BASIC program
+// https://github.com/Kibisoft/TinyBasic
+//
+// MIT License, see TinyBasic.h
+//
+// A group of W instances of the same program, each with its own variables,
+// runs with a single instruction pointer. Values are stored as structures of
+// arrays, one slot per lane, so each instruction is dispatched once for the
+// whole group and its work is a fixed length loop over the lanes that the
+// compiler turns into vector instructions.
+//
+// When an IF only guards assignments or PRINT, the lanes where it is false
+// are masked while the statement runs. When the lanes take different paths
+// (IF ... THEN GOTO, a computed GOTO, FOR and NEXT with different bounds),
+// the group keeps the larger part and the other lanes leave the group at
+// the exact point of divergence as ordinary VirtualMachines. When too few
+// lanes are left, or a line needs something the group cannot do (INPUT,
+// callbacks), every remaining lane leaves and the machines end the run alone.
+
+#include "TinyBasic.h"
+
+template<class number, class VariableSet, size_t W = 8> class BasicLockstepMachine
+{
+    static_assert(W > 0 && W <= 64, "a group has 1 to 64 lanes");
+
+public:
+    typedef BasicVirtualMachine<number, VariableSet> VirtualMachine;
+    typedef typename VirtualMachine::InstructionSet InstructionSet;
+    typedef typename VirtualMachine::Program Program;
+
+    // a group leaves lockstep when it has fewer lanes than this
+    size_t minimum_lanes = W / 4;
+
+    // instructions dispatched for whole groups, and lanes that ended the run on their own
+    size_t dispatched = 0;
+    size_t diverged = 0;
+
+private:
+    struct alignas(64) lanes
+    {
+        number value[W];
+
+        number& operator[](size_t l) { return value[l]; }
+        const number& operator[](size_t l) const { return value[l]; }
+    };
+
+    typedef typename Program::const_iterator position;
+
+    struct Loop
+    {
+        size_t variable;
+        lanes limit;
+        lanes step;
+        position line;
+        size_t instruction;
+    };
+
+    shared_ptr<const Program> program;
+    set<size_t> scalar_lines; // lines with instructions only a single machine can run
+
+    VirtualMachine* machines[W];
+    uint64_t live = 0;    // lanes still in the group
+    uint64_t active = 0;  // lanes the current statement applies to
+
+    vector<lanes> variables; // then the temporaries of the compiler
+    string output[W];
+    size_t column[W];
+    vector<aligned_array<number>> arrays; // value i of lane l at i * W + l
+    vector<lanes> stack;
+    vector<Loop> loops;
+    vector<pair<position, size_t>> returns;
+
+    position current_line;
+    size_t current_instruction;
+
+    vector<function<void(BasicLockstepMachine&)>> instructions = {
+        &BasicLockstepMachine::i_nop,
+        &BasicLockstepMachine::i_push,
+        &BasicLockstepMachine::i_pop,
+        &BasicLockstepMachine::i_jne,
+
+        &BasicLockstepMachine::i_arithmetic<std::plus<number>>,
+        &BasicLockstepMachine::i_arithmetic<std::minus<number>>,
+        &BasicLockstepMachine::i_arithmetic<std::multiplies<number>>,
+        &BasicLockstepMachine::i_div,
+
+        &BasicLockstepMachine::i_setvar,
+        &BasicLockstepMachine::i_getvar,
+
+        &BasicLockstepMachine::i_goto,
+        &BasicLockstepMachine::i_gosub,
+        &BasicLockstepMachine::i_return,
+
+        &BasicLockstepMachine::i_end,
+
+        &BasicLockstepMachine::i_compare<std::equal_to<number>>,
+        &BasicLockstepMachine::i_compare<std::not_equal_to<number>>,
+        &BasicLockstepMachine::i_compare<std::greater<number>>,
+        &BasicLockstepMachine::i_compare<std::less<number>>,
+        &BasicLockstepMachine::i_compare<std::greater_equal<number>>,
+        &BasicLockstepMachine::i_compare<std::less_equal<number>>,
+
+        &BasicLockstepMachine::i_print,
+        &BasicLockstepMachine::i_scalar, // input
+
+        &BasicLockstepMachine::i_scalar, // call
+        &BasicLockstepMachine::i_scalar, // call_proc
+
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::abs>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::acs>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::asn>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::atn>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::cos>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::exp>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::integer>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::ln>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::log>,
+        &BasicLockstepMachine::i_pi,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::rnd>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::sgn>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::sin>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::sqr>,
+        &BasicLockstepMachine::i_function<&VirtualMachine::math::tan>,
+
+        &BasicLockstepMachine::i_scalar, // call_host
+        &BasicLockstepMachine::i_scalar, // call_host_proc
+
+        &BasicLockstepMachine::i_dim,
+        &BasicLockstepMachine::i_getarr,
+        &BasicLockstepMachine::i_setarr,
+        &BasicLockstepMachine::i_getarr,
+        &BasicLockstepMachine::i_setarr,
+
+        &BasicLockstepMachine::i_for,
+        &BasicLockstepMachine::i_next,
+
+        &BasicLockstepMachine::i_print_value,
+        &BasicLockstepMachine::i_print_string,
+        &BasicLockstepMachine::i_print_tab,
+        &BasicLockstepMachine::i_print_end,
+
+        &BasicLockstepMachine::i_scalar, // parallel
+        &BasicLockstepMachine::i_scalar, // reduce
+
+        &BasicLockstepMachine::i_scalar, // mat_binary
+        &BasicLockstepMachine::i_scalar, // mat_scalar
+        &BasicLockstepMachine::i_scalar, // mat_function
+        &BasicLockstepMachine::i_scalar, // mat_sum
+        &BasicLockstepMachine::i_scalar, // mat_dot
+
+        &BasicLockstepMachine::i_scalar, // send
+        &BasicLockstepMachine::i_scalar, // recv
+
+        &BasicLockstepMachine::i_data,
+        &BasicLockstepMachine::i_scalar, // read
+        &BasicLockstepMachine::i_scalar, // mat_read
+        &BasicLockstepMachine::i_scalar, // restore
+
+        &BasicLockstepMachine::i_settemp,
+        &BasicLockstepMachine::i_gettemp,
+    };
+
+    // thrown when the current statement must be run again by each machine alone
+    struct scalar {};
+
+public:
+
+    // runs every machine to its end, each one starts with its own variables and receives its final state
+    vector<status> run(shared_ptr<const Program> p, vector<VirtualMachine>& all)
+    {
+        if (!p->count(0))
+        {
+            shared_ptr<Program> copy = make_shared<Program>(*p);
+            copy->emplace(0, InstructionSet());
+            p = copy;
+        }
+
+        program = p;
+
+        for (VirtualMachine& machine : all)
+            machine.load(program);
+
+        // a rejected program is left to the machines, which report why
+        if (all.empty() || all[0].loadErrors().empty())
+        {
+            scalar_lines.clear();
+            for (auto& l : *program)
+            {
+                const InstructionSet& set = l.second;
+                for (size_t i = 0; i < set.size(); i = set.next(i))
+                {
+                    if (isScalar(set.op(i)))
+                        scalar_lines.insert(l.first);
+                }
+            }
+
+            for (size_t first = 0; first < all.size(); first += W)
+                group(&all[first], min(W, all.size() - first));
+        }
+
+        vector<status> result;
+        for (VirtualMachine& machine : all)
+            result.push_back(machine.step((size_t)-1));
+
+        return result;
+    }
+
+private:
+
+    static bool isScalar(instruction i)
+    {
+        switch (i)
+        {
+        case instruction::input:
+        case instruction::call:
+        case instruction::call_proc:
+        case instruction::call_host:
+        case instruction::call_host_proc:
+        case instruction::parallel:
+        case instruction::mat_binary:
+        case instruction::mat_scalar:
+        case instruction::mat_function:
+        case instruction::mat_sum:
+        case instruction::mat_dot:
+        case instruction::send:
+        case instruction::recv:
+        case instruction::read:
+        case instruction::mat_read:
+        case instruction::restore:
+            return true;
+
+        default:
+            return false;
+        }
+    }
+
+    static size_t count(uint64_t mask)
+    {
+        size_t n = 0;
+        for (; mask; mask &= mask - 1)
+            n++;
+        return n;
+    }
+
+    static bool in(uint64_t mask, size_t l) { return (mask >> l) & 1; }
+
+    void group(VirtualMachine* lane_machines, size_t n)
+    {
+        live = n == 64 ? ~(uint64_t)0 : ((uint64_t)1 << n) - 1;
+        active = live;
+
+        for (size_t l = 0; l < n; l++)
+            machines[l] = &lane_machines[l];
+
+        size_t temporaries = machines[0]->temporaries.size();
+        variables.assign(VariableSet::size + temporaries, lanes());
+        for (size_t v = 0; v < VariableSet::size; v++)
+            for (size_t l = 0; l < n; l++)
+                variables[v][l] = machines[l]->variables[v];
+        for (size_t t = 0; t < temporaries; t++)
+            for (size_t l = 0; l < n; l++)
+                variables[VariableSet::size + t][l] = machines[l]->temporaries[t];
+
+        for (size_t l = 0; l < n; l++)
+        {
+            output[l].clear();
+            column[l] = machines[l]->column;
+        }
+
+        // arrays given by the host must have the same size in every lane
+        arrays.clear();
+        for (size_t l = 0; l < n; l++)
+        {
+            if (machines[l]->arrays.size() != machines[0]->arrays.size())
+                return;
+            for (size_t a = 0; a < machines[0]->arrays.size(); a++)
+                if (machines[l]->arrays[a].size() != machines[0]->arrays[a].size())
+                    return;
+        }
+
+        arrays.resize(machines[0]->arrays.size());
+        for (size_t a = 0; a < arrays.size(); a++)
+        {
+            arrays[a].resize(machines[0]->arrays[a].size() * W);
+            for (size_t l = 0; l < n; l++)
+                for (size_t i = 0; i < machines[l]->arrays[a].size(); i++)
+                    arrays[a][i * W + l] = machines[l]->arrays[a][i];
+        }
+
+        stack.clear();
+        loops.clear();
+        returns.clear();
+
+        current_line = program->begin();
+        current_instruction = 0;
+
+        while (live && current_line != program->end())
+        {
+            if (count(live) < minimum_lanes || (!scalar_lines.empty() && scalar_lines.count(current_line->first)))
+            {
+                leave(live, current_line, current_instruction);
+                break;
+            }
+
+            // a statement only writes its results once they are all evaluated, so it can be started again
+            position line = current_line;
+
+            try
+            {
+                while (live && current_line != program->end() && current_instruction < current_line->second.size())
+                    execInstruction();
+            }
+            catch (...)
+            {
+                // errors are raised again, for the right lanes only, by the machines on their own
+                stack.clear();
+                active = live;
+                leave(live, line, 0);
+                break;
+            }
+
+            if (live && current_line != program->end())
+            {
+                current_line++;
+                current_instruction = 0;
+            }
+        }
+
+        for (size_t l = 0; l < W; l++)
+        {
+            if (in(live, l))
+            {
+                store(l);
+                machines[l]->current_line = program->end();
+            }
+        }
+
+        live = 0;
+    }
+
+    // copies the state of a lane to its machine
+    void store(size_t l)
+    {
+        VirtualMachine& machine = *machines[l];
+
+        for (size_t v = 0; v < VariableSet::size; v++)
+            machine.variables[v] = variables[v][l];
+        for (size_t t = 0; t < machine.temporaries.size(); t++)
+            machine.temporaries[t] = variables[VariableSet::size + t][l];
+
+        // a statement left in the middle is run again by the machine
+        output[l].clear();
+        machine.column = column[l];
+
+        machine.arrays.resize(arrays.size());
+        for (size_t a = 0; a < arrays.size(); a++)
+        {
+            machine.arrays[a].resize(arrays[a].size() / W);
+            for (size_t i = 0; i < machine.arrays[a].size(); i++)
+                machine.arrays[a][i] = arrays[a][i * W + l];
+        }
+
+        machine.stack.clear();
+
+        machine.loops.clear();
+        for (Loop& loop : loops)
+            machine.loops.push_back({ loop.variable, loop.limit[l], loop.step[l], loop.line, loop.instruction });
+
+        machine.returns = returns;
+    }
+
+    // the lanes of mask go on alone, from the given position
+    void leave(uint64_t mask, position line, size_t instruction)
+    {
+        for (size_t l = 0; l < W; l++)
+        {
+            if (in(mask, l))
+            {
+                store(l);
+                machines[l]->current_line = line;
+                machines[l]->current_instruction = instruction;
+                diverged++;
+            }
+        }
+
+        live &= ~mask;
+        active &= ~mask;
+    }
+
+    // the larger part stays in the group at its position, the other one leaves at its own
+    void diverge(uint64_t a, position a_line, size_t a_instruction, uint64_t b, position b_line, size_t b_instruction)
+    {
+        if (count(a) < count(b))
+        {
+            swap(a, b);
+            swap(a_line, b_line);
+            swap(a_instruction, b_instruction);
+        }
+
+        leave(b, b_line, b_instruction);
+
+        current_line = a_line;
+        current_instruction = a_instruction;
+    }
+
+    void execInstruction()
+    {
+        function<void(BasicLockstepMachine&)>& instruction = instructions[(size_t)current_line->second.op(current_instruction)];
+        current_instruction++;
+        dispatched++;
+        instruction(*this);
+    }
+
+    size_t immediate()
+    {
+        return current_line->second.read(current_instruction);
+    }
+
+    lanes& top() { return stack.back(); }
+    lanes& below() { return stack[stack.size() - 2]; }
+
+    void push(number value)
+    {
+        stack.emplace_back();
+        for (size_t l = 0; l < W; l++)
+            top()[l] = value;
+    }
+
+    void i_nop() {}
+
+    void i_scalar()
+    {
+        throw scalar();
+    }
+
+    // each machine keeps its own position in the DATA, the lanes leave before READ
+    void i_data()
+    {
+        current_instruction += immediate() * sizeof(number);
+    }
+
+    void i_push()
+    {
+        push(current_line->second.value(current_instruction));
+    }
+
+    void i_pop()
+    {
+        stack.pop_back();
+    }
+
+    void i_jne()
+    {
+        uint64_t taken = 0;
+        for (size_t l = 0; l < W; l++)
+            taken |= (uint64_t)(top()[l] != 0) << l;
+        taken &= active;
+        stack.pop_back();
+
+        size_t length = current_line->second.read(current_instruction);
+        size_t statement = current_instruction;
+
+        if (taken == active)
+        {
+            current_instruction = statement;
+        }
+        else if (taken == 0)
+        {
+            current_instruction = statement + length;
+        }
+        else if (guards(statement, length))
+        {
+            // the statement runs with the other lanes masked
+            uint64_t saved = active;
+            active = taken;
+
+            current_instruction = statement;
+            while (current_instruction < statement + length)
+                execInstruction();
+
+            active = saved;
+        }
+        else
+            diverge(taken, current_line, statement, active & ~taken, current_line, statement + length);
+    }
+
+    // a statement without jumps, loops or allocations can run masked
+    bool guards(size_t statement, size_t length)
+    {
+        const InstructionSet& set = current_line->second;
+        for (size_t i = statement; i < statement + length; i = set.next(i))
+        {
+            switch (set.op(i))
+            {
+            case instruction::got:
+            case instruction::gosub:
+            case instruction::ret:
+            case instruction::end:
+            case instruction::dim:
+            case instruction::forloop:
+            case instruction::next:
+                return false;
+
+            default:
+                break;
+            }
+        }
+
+        return true;
+    }
+
+    template<class operation> void i_arithmetic()
+    {
+        execInstruction();
+        execInstruction();
+
+        lanes& a = below();
+        const lanes& b = top();
+        for (size_t l = 0; l < W; l++)
+            a[l] = operation()(a[l], b[l]);
+
+        stack.pop_back();
+    }
+
+    void i_div()
+    {
+        execInstruction();
+        execInstruction();
+
+        lanes& a = below();
+        const lanes& b = top();
+
+        if constexpr (is_integral_v<number>)
+        {
+            for (size_t l = 0; l < W; l++)
+                if (in(active, l) && b[l] == 0)
+                    throw domain_error("division by zero");
+
+            for (size_t l = 0; l < W; l++)
+                a[l] /= b[l] == 0 ? 1 : b[l];
+        }
+        else
+        {
+            for (size_t l = 0; l < W; l++)
+                a[l] /= b[l];
+        }
+
+        stack.pop_back();
+    }
+
+    template<class comparison> void i_compare()
+    {
+        execInstruction();
+        execInstruction();
+
+        lanes& a = below();
+        const lanes& b = top();
+        for (size_t l = 0; l < W; l++)
+            a[l] = comparison()(a[l], b[l]) ? (number)1 : (number)0;
+
+        stack.pop_back();
+    }
+
+    template<number(*f)(number)> void i_function()
+    {
+        execInstruction();
+
+        lanes& a = top();
+        for (size_t l = 0; l < W; l++)
+            a[l] = f(a[l]);
+    }
+
+    void i_pi()
+    {
+        push((number)3.14159265358979323846);
+    }
+
+    // each lane fills its own buffer, written at the end of the statement
+    void i_print()
+    {
+        i_print_value();
+
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l))
+                output[l] += '\n';
+
+        write();
+    }
+
+    void i_print_value()
+    {
+        execInstruction();
+
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l))
+                VirtualMachine::format(output[l], top()[l]);
+
+        stack.pop_back();
+    }
+
+    void i_print_string()
+    {
+        string_view text = current_line->second.text(current_instruction);
+
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l))
+                output[l] += text;
+    }
+
+    void i_print_tab()
+    {
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l))
+                VirtualMachine::tab(output[l], column[l]);
+    }
+
+    void i_print_end()
+    {
+        if (immediate())
+        {
+            for (size_t l = 0; l < W; l++)
+                if (in(active, l))
+                    output[l] += '\n';
+        }
+
+        write();
+    }
+
+    void write()
+    {
+        for (size_t l = 0; l < W; l++)
+        {
+            if (in(active, l))
+            {
+                machines[l]->metrics.prints++;
+                machines[l]->metrics.print_bytes += output[l].size();
+
+                machines[l]->console->write(output[l].data(), output[l].size());
+                column[l] = VirtualMachine::columnAfter(output[l], column[l]);
+                output[l].clear();
+            }
+        }
+    }
+
+    // the value of the expression that follows, in the active lanes
+    void assign(lanes& v)
+    {
+        execInstruction();
+
+        const lanes& value = top();
+        for (size_t l = 0; l < W; l++)
+            v[l] = in(active, l) ? value[l] : v[l];
+
+        stack.pop_back();
+    }
+
+    void i_setvar()
+    {
+        assign(variables[immediate()]);
+    }
+
+    void i_getvar()
+    {
+        stack.push_back(variables[immediate()]);
+    }
+
+    void i_settemp()
+    {
+        assign(variables[VariableSet::size + immediate()]);
+    }
+
+    void i_gettemp()
+    {
+        stack.push_back(variables[VariableSet::size + immediate()]);
+    }
+
+    // target line shared by the most active lanes
+    size_t target(const lanes& lines, uint64_t& lanes_to_target)
+    {
+        size_t best = 0, best_count = 0;
+        for (size_t l = 0; l < W; l++)
+        {
+            if (!in(active, l))
+                continue;
+
+            uint64_t same = 0;
+            for (size_t k = 0; k < W; k++)
+                same |= (uint64_t)(in(active, k) && (size_t)lines[k] == (size_t)lines[l]) << k;
+
+            if (count(same) > best_count)
+            {
+                best = (size_t)lines[l];
+                best_count = count(same);
+                lanes_to_target = same;
+            }
+        }
+        return best;
+    }
+
+    // the lanes going elsewhere leave as if they had jumped
+    void jump(const lanes& lines)
+    {
+        uint64_t group = active;
+        size_t line = target(lines, group);
+
+        for (size_t l = 0; l < W; l++)
+        {
+            if (in(active & ~group, l))
+            {
+                position p = program->find((size_t)lines[l]);
+                if (p == program->end())
+                    throw out_of_range("undefined line");
+
+                p--;
+                leave((uint64_t)1 << l, p, p->second.size());
+            }
+        }
+
+        current_line = program->find(line);
+        if (current_line == program->end())
+            throw out_of_range("undefined line");
+
+        current_line--;
+        current_instruction = current_line->second.size();
+    }
+
+    void i_goto()
+    {
+        immediate(); // cache site, the group resolves its targets itself
+        execInstruction();
+        lanes lines = top();
+        stack.pop_back();
+
+        jump(lines);
+    }
+
+    void i_gosub()
+    {
+        immediate(); // cache site, the group resolves its targets itself
+        execInstruction();
+        lanes lines = top();
+        stack.pop_back();
+
+        returns.push_back({ current_line, current_instruction });
+
+        jump(lines);
+    }
+
+    void i_return()
+    {
+        if (returns.empty())
+            throw logic_error("RETURN without GOSUB");
+
+        current_line = returns.back().first;
+        current_instruction = returns.back().second;
+        returns.pop_back();
+    }
+
+    void i_end()
+    {
+        current_line = program->end();
+    }
+
+    void i_dim()
+    {
+        size_t array = immediate();
+        execInstruction();
+
+        number size = top()[0];
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l) && (top()[l] != size || size < 0))
+                throw scalar();
+
+        // the machines report what cannot be allocated
+        if (!VirtualMachine::allocatable(size) || (size_t)size >= SIZE_MAX / sizeof(number) / W)
+            throw scalar();
+
+        size_t others = 0;
+        for (size_t a = 0; a < arrays.size(); a++)
+        {
+            if (a != array)
+                others += arrays[a].size() / W;
+        }
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l) && (others > machines[l]->array_limit || (size_t)size >= machines[l]->array_limit - others))
+                throw scalar();
+
+        stack.pop_back();
+
+        if (array >= arrays.size())
+            arrays.resize(array + 1);
+
+        arrays[array].resize(((size_t)size + 1) * W);
+    }
+
+    size_t index(size_t array, number i, size_t l)
+    {
+        if (!in(active, l))
+            return (size_t)-1;
+
+        if (array >= arrays.size() || i < 0 || (size_t)i >= arrays[array].size() / W)
+            throw out_of_range("array index out of bounds");
+
+        return (size_t)i * W + l;
+    }
+
+    void i_getarr()
+    {
+        size_t array = immediate();
+        execInstruction();
+
+        lanes& a = top();
+        for (size_t l = 0; l < W; l++)
+        {
+            size_t i = index(array, a[l], l);
+            a[l] = i != (size_t)-1 ? arrays[array][i] : 0;
+        }
+    }
+
+    void i_setarr()
+    {
+        size_t array = immediate();
+        execInstruction();
+        execInstruction();
+
+        const lanes& i = below();
+        const lanes& value = top();
+        for (size_t l = 0; l < W; l++)
+            if (in(active, l))
+                arrays[array][index(array, i[l], l)] = value[l];
+
+        stack.pop_back();
+        stack.pop_back();
+    }
+
+    static bool inLoop(number value, number limit, number step)
+    {
+        return step < 0 ? value >= limit : value <= limit;
+    }
+
+    void i_for()
+    {
+        size_t variable = immediate();
+        size_t next = current_line->second.readWord(current_instruction);
+
+        execInstruction();
+        execInstruction();
+        execInstruction();
+
+        Loop loop = { variable, below(), top(), current_line, current_instruction };
+        variables[variable] = stack[stack.size() - 3];
+        stack.resize(stack.size() - 3);
+
+        for (size_t i = 0; i < loops.size(); i++)
+        {
+            if (loops[i].variable == variable)
+            {
+                loops.resize(i);
+                break;
+            }
+        }
+
+        uint64_t enter = active;
+        if (next != 0)
+        {
+            enter = 0;
+            for (size_t l = 0; l < W; l++)
+                enter |= (uint64_t)inLoop(variables[variable][l], loop.limit[l], loop.step[l]) << l;
+            enter &= active;
+        }
+
+        position after = next != 0 ? program->find(next) : current_line;
+
+        if (enter != active && enter != 0 && count(enter) < count(active & ~enter))
+        {
+            // most lanes skip the loop : the others leave with their frame
+            loops.push_back(loop);
+            leave(enter, current_line, current_instruction);
+            loops.pop_back();
+            enter = 0;
+        }
+        else if (enter != active && enter != 0)
+            leave(active & ~enter, after, after->second.size());
+
+        if (enter == 0)
+        {
+            current_line = after;
+            current_instruction = current_line->second.size();
+        }
+        else
+            loops.push_back(loop);
+    }
+
+    void i_next()
+    {
+        size_t variable = immediate();
+
+        if (variable != (size_t)-1)
+        {
+            while (!loops.empty() && loops.back().variable != variable)
+                loops.pop_back();
+        }
+
+        if (loops.empty())
+            throw logic_error("NEXT without FOR");
+
+        Loop& loop = loops.back();
+        lanes& value = variables[loop.variable];
+
+        uint64_t again = 0;
+        for (size_t l = 0; l < W; l++)
+        {
+            value[l] += loop.step[l];
+            again |= (uint64_t)inLoop(value[l], loop.limit[l], loop.step[l]) << l;
+        }
+        again &= active;
+
+        if (again == active)
+        {
+            current_line = loop.line;
+            current_instruction = loop.instruction;
+        }
+        else if (again == 0)
+            loops.pop_back();
+        else if (count(again) >= count(active & ~again))
+        {
+            Loop ended = loop;
+            loops.pop_back();
+            leave(active & ~again, current_line, current_instruction);
+            loops.push_back(ended);
+
+            current_line = ended.line;
+            current_instruction = ended.instruction;
+        }
+        else
+        {
+            leave(again, loop.line, loop.instruction);
+            loops.pop_back();
+        }
+    }
+};
+
+typedef BasicLockstepMachine<number, Variables> LockstepMachine;
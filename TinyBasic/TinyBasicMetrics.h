@@ -0,0 +1,134 @@
+#pragma once
+
+// counters of many Tiny BASIC machines in Prometheus text format
+// https://github.com/Kibisoft/TinyBasic
+//
+// MIT License, see TinyBasic.h
+//
+// Every machine keeps its own Metrics, see BasicVirtualMachine::counters.
+// The aggregator adds the counters of the machines handed to it and keeps
+// the highest of the high-water marks, it can be shared between threads.
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN // without winsock.h, which TinyBasicServer.h replaces by winsock2.h
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX // min and max are the ones of std
+#endif
+#include <windows.h>
+#endif
+
+#include "TinyBasic.h"
+
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+class MetricsAggregator
+{
+    mutable mutex lock;
+    Metrics total;
+    uint64_t machines = 0;
+
+public:
+    void add(const Metrics& metrics)
+    {
+        lock_guard<mutex> guard(lock);
+
+        machines++;
+        total.runs += metrics.runs;
+        total.instructions += metrics.instructions;
+        total.lines += metrics.lines;
+        total.gosub_depth = max(total.gosub_depth, metrics.gosub_depth);
+        total.stack_depth = max(total.stack_depth, metrics.stack_depth);
+        total.prints += metrics.prints;
+        total.print_bytes += metrics.print_bytes;
+        total.inputs += metrics.inputs;
+        total.nanoseconds += metrics.nanoseconds;
+    }
+
+    template<class number, class VariableSet> void add(const BasicVirtualMachine<number, VariableSet>& vm)
+    {
+        add(vm.counters());
+    }
+
+    Metrics snapshot() const
+    {
+        lock_guard<mutex> guard(lock);
+        return total;
+    }
+
+    // text exposition format, one family per counter
+    string prometheus() const
+    {
+        Metrics m;
+        uint64_t count;
+        {
+            lock_guard<mutex> guard(lock);
+            m = total;
+            count = machines;
+        }
+
+        string text;
+        family(text, "tinybasic_machines_total", "counter", "Machines added to the aggregate.", count);
+        family(text, "tinybasic_runs_total", "counter", "Programs loaded.", m.runs);
+        family(text, "tinybasic_instructions_total", "counter", "Instructions dispatched.", m.instructions);
+        family(text, "tinybasic_lines_total", "counter", "Lines executed.", m.lines);
+        family(text, "tinybasic_gosub_depth_max", "gauge", "Deepest GOSUB nesting.", m.gosub_depth);
+        family(text, "tinybasic_stack_depth_max", "gauge", "Deepest operand stack.", m.stack_depth);
+        family(text, "tinybasic_prints_total", "counter", "PRINT statements executed.", m.prints);
+        family(text, "tinybasic_print_bytes_total", "counter", "Bytes written by PRINT.", m.print_bytes);
+        family(text, "tinybasic_inputs_total", "counter", "Values read by INPUT.", m.inputs);
+
+        // seconds are the base unit, the nanoseconds are kept exact until here
+        char seconds[32];
+        snprintf(seconds, sizeof(seconds), "%llu.%09llu", (unsigned long long)(m.nanoseconds / 1000000000), (unsigned long long)(m.nanoseconds % 1000000000));
+        text += "# HELP tinybasic_run_seconds_total Wall time spent running.\n# TYPE tinybasic_run_seconds_total counter\ntinybasic_run_seconds_total ";
+        text += seconds;
+        text += "\n";
+
+        return text;
+    }
+
+    // writes the snapshot to a temporary file renamed over path, so a scraper never reads half of it
+    bool write(const string& path) const
+    {
+        string temporary = path + ".tmp";
+        {
+            ofstream file(temporary, ios::binary | ios::trunc);
+            if (!file)
+                return false;
+
+            string text = prometheus();
+            file.write(text.data(), text.size());
+            if (!file)
+                return false;
+        }
+
+        // the file is replaced in one step, path always names the old snapshot or the new one
+#ifdef _WIN32
+        return MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(temporary.c_str(), path.c_str()) == 0;
+#endif
+    }
+
+private:
+    static void family(string& text, const char* name, const char* type, const char* help, uint64_t value)
+    {
+        text += "# HELP ";
+        text += name;
+        text += " ";
+        text += help;
+        text += "\n# TYPE ";
+        text += name;
+        text += " ";
+        text += type;
+        text += "\n";
+        text += name;
+        text += " ";
+        text += to_string(value);
+        text += "\n";
+    }
+};
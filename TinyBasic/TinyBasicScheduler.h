@@ -0,0 +1,227 @@
+#pragma once
+
+// M:N scheduling of Tiny BASIC sessions
+// https://github.com/Kibisoft/TinyBasic
+//
+// MIT License, see TinyBasic.h
+//
+// Many sessions share a few worker threads. A session runs in slices of
+// instructions; when its program executes INPUT without a value it is
+// parked, with no thread attached, until the host supplies one with
+// input(). The saved state of the machine is the continuation. A session
+// blocked on a channel sleeps, channels do not signal, and is tried again
+// later, twice as late each time it finds the channel still not ready.
+
+#include "TinyBasic.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+template<class number, class VariableSet> class BasicScheduler
+{
+public:
+    typedef BasicVirtualMachine<number, VariableSet> VirtualMachine;
+    typedef typename VirtualMachine::Program Program;
+
+    // called from a worker when a session waits for INPUT, answer later with input()
+    function<void(size_t)> waiting;
+
+    // called from a worker when a session ends, the session is then destroyed
+    function<void(size_t, status, VirtualMachine&)> finished;
+
+private:
+    enum class state { parked, sleeping, queued, running };
+
+    typedef chrono::steady_clock clock;
+
+    struct Session
+    {
+        VirtualMachine vm;
+        state current = state::queued;
+        deque<number> inputs; // supplied while the machine was not parked
+        chrono::microseconds backoff{ 0 }; // before the next try of a blocked channel
+    };
+
+    static constexpr chrono::microseconds min_backoff{ 50 };
+    static constexpr chrono::microseconds max_backoff{ 10000 };
+
+    size_t slice;
+
+    mutex lock;
+    condition_variable wakeup;
+    deque<size_t> ready;
+    multimap<clock::time_point, size_t> sleeping; // sessions blocked on a channel, by the time they are tried again
+    map<size_t, unique_ptr<Session>> sessions;
+    size_t next_session = 0;
+    bool stopping = false;
+
+    vector<thread> workers;
+
+public:
+    BasicScheduler(size_t threads = thread::hardware_concurrency(), size_t slice = 4096) : slice(slice)
+    {
+        if (threads == 0)
+            threads = 1;
+
+        for (size_t i = 0; i < threads; i++)
+            workers.emplace_back(&BasicScheduler::work, this);
+    }
+
+    ~BasicScheduler()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+        }
+        wakeup.notify_all();
+
+        for (thread& worker : workers)
+            worker.join();
+    }
+
+    // starts a new session on a compiled program, see BasicTinyBasic::compile
+    size_t start(shared_ptr<const Program> program)
+    {
+        unique_ptr<Session> session = make_unique<Session>();
+        session->vm.load(program);
+
+        size_t id;
+        {
+            lock_guard<mutex> guard(lock);
+            id = next_session++;
+            sessions[id] = move(session);
+            ready.push_back(id);
+        }
+        wakeup.notify_one();
+
+        return id;
+    }
+
+    // value for the pending or next INPUT of a session, resumes it if it was parked
+    void input(size_t id, number value)
+    {
+        {
+            lock_guard<mutex> guard(lock);
+
+            auto session = sessions.find(id);
+            if (session == sessions.end())
+                return;
+
+            session->second->inputs.push_back(value);
+
+            if (session->second->current != state::parked)
+                return;
+
+            session->second->current = state::queued;
+            ready.push_back(id);
+        }
+        wakeup.notify_one();
+    }
+
+    size_t active()
+    {
+        lock_guard<mutex> guard(lock);
+        return sessions.size();
+    }
+
+private:
+    void work()
+    {
+        while (true)
+        {
+            Session* session;
+            size_t id;
+
+            {
+                unique_lock<mutex> guard(lock);
+                for (wake(); !stopping && ready.empty(); wake())
+                {
+                    if (sleeping.empty())
+                        wakeup.wait(guard);
+                    else
+                        wakeup.wait_until(guard, sleeping.begin()->first);
+                }
+
+                if (stopping)
+                    return;
+
+                id = ready.front();
+                ready.pop_front();
+
+                session = sessions[id].get();
+                session->current = state::running;
+
+                for (number value : session->inputs)
+                    session->vm.input(value);
+                session->inputs.clear();
+            }
+
+            size_t executed = session->vm.instructionsExecuted();
+            status s = session->vm.step(slice);
+
+            if (s == status::exhausted || s == status::waiting || s == status::blocked)
+            {
+                bool parked = false;
+                {
+                    lock_guard<mutex> guard(lock);
+
+                    if (s == status::blocked)
+                    {
+                        // the wait starts again from the shortest when the session went on before it blocked
+                        if (session->vm.instructionsExecuted() != executed)
+                            session->backoff = chrono::microseconds(0);
+                        session->backoff = clamp(session->backoff * 2, min_backoff, max_backoff);
+
+                        session->current = state::sleeping;
+                        sleeping.emplace(clock::now() + session->backoff, id);
+                    }
+                    // a value may have arrived during the slice
+                    else if (s == status::exhausted || !session->inputs.empty())
+                    {
+                        session->current = state::queued;
+                        ready.push_back(id);
+                    }
+                    else
+                    {
+                        session->current = state::parked;
+                        parked = true;
+                    }
+                }
+
+                if (parked)
+                {
+                    if (waiting)
+                        waiting(id);
+                }
+                else
+                    wakeup.notify_one(); // a worker waiting for nothing, or later, takes the session or its new time
+            }
+            else
+            {
+                if (finished)
+                    finished(id, s, session->vm);
+
+                lock_guard<mutex> guard(lock);
+                sessions.erase(id);
+            }
+        }
+    }
+
+    // sessions whose sleep is over go back to the ready queue, under the lock
+    void wake()
+    {
+        clock::time_point now = clock::now();
+        while (!sleeping.empty() && sleeping.begin()->first <= now)
+        {
+            size_t id = sleeping.begin()->second;
+            sleeping.erase(sleeping.begin());
+
+            sessions[id]->current = state::queued;
+            ready.push_back(id);
+        }
+    }
+};
+
+typedef BasicScheduler<number, Variables> Scheduler;
@@ -0,0 +1,785 @@
+#pragma once
+
+// local multi-tenant execution server for Tiny BASIC
+// https://github.com/Kibisoft/TinyBasic
+//
+// MIT License, see TinyBasic.h
+//
+// Clients talk to the server over a Unix domain socket with a line based
+// protocol, one request at a time on each connection:
+//
+//   PROGRAM <bytes>\n<source>
+//       -> PROGRAM <id>\n or ERROR <message>\n
+//   RUN <id> <instructions> <milliseconds> [<input> ...]\n
+//       -> OUTPUT <bytes>\n<text> ... VARIABLE <index> <value>\n ...
+//          DONE <status> <instructions>[ <message>]\n
+//   QUIT\n
+//
+// A program is compiled and verified once and cached under the SHA-256 of
+// its source, its id, which no other source takes over. A run borrows a
+// machine from a pool allocated when the server starts, so the number of
+// runs at once is bounded whatever the number of clients. The PRINT output
+// of a run is sent after every slice of instructions and its variables when
+// it ends. A run stops when it uses its instructions or its time, with the
+// status exhausted or timeout, and its arrays can only hold so many elements.
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX // min and max are the ones of std
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "TinyBasic.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+// a stream over a Unix domain socket, with the reads buffered
+class LocalConnection
+{
+public:
+#ifdef _WIN32
+    typedef SOCKET handle;
+    static constexpr handle invalid = INVALID_SOCKET;
+#else
+    typedef int handle;
+    static constexpr handle invalid = -1;
+#endif
+
+private:
+    handle socket_handle = invalid;
+    string buffer;
+    size_t seek = 0;
+
+public:
+    LocalConnection() {}
+    explicit LocalConnection(handle h) : socket_handle(h) {}
+    LocalConnection(const LocalConnection&) = delete;
+    LocalConnection& operator=(const LocalConnection&) = delete;
+
+    ~LocalConnection()
+    {
+        close(socket_handle);
+    }
+
+    // connects to a server, throws when nobody listens on path
+    static unique_ptr<LocalConnection> connect(const string& path)
+    {
+        handle h = open(path);
+        if (h == invalid)
+            throw runtime_error("cannot open " + path);
+
+        sockaddr_un address = addressOf(path);
+        if (::connect(h, (const sockaddr*)&address, sizeof(address)) != 0)
+        {
+            close(h);
+            throw runtime_error("cannot connect to " + path);
+        }
+
+        return make_unique<LocalConnection>(h);
+    }
+
+    // socket accepting connections on path, an old socket file is replaced
+    static handle listen(const string& path)
+    {
+        handle h = open(path);
+        if (h == invalid)
+            return invalid;
+
+        remove(path.c_str());
+
+        sockaddr_un address = addressOf(path);
+        if (::bind(h, (const sockaddr*)&address, sizeof(address)) != 0 || ::listen(h, SOMAXCONN) != 0)
+        {
+            close(h);
+            return invalid;
+        }
+
+        return h;
+    }
+
+    static void close(handle h)
+    {
+        if (h == invalid)
+            return;
+#ifdef _WIN32
+        closesocket(h);
+#else
+        ::close(h);
+#endif
+    }
+
+    // wakes up a thread blocked on the socket, reads and accepts then fail
+    static void shutdown(handle h)
+    {
+#ifdef _WIN32
+        ::shutdown(h, SD_BOTH);
+#else
+        ::shutdown(h, SHUT_RDWR);
+#endif
+    }
+
+    void interrupt()
+    {
+        shutdown(socket_handle);
+    }
+
+    bool write(string_view text)
+    {
+        while (!text.empty())
+        {
+#ifdef _WIN32
+            int sent = ::send(socket_handle, text.data(), (int)min(text.size(), (size_t)1 << 30), 0);
+#else
+            ssize_t sent = ::send(socket_handle, text.data(), text.size(), MSG_NOSIGNAL);
+#endif
+            if (sent <= 0)
+                return false;
+
+            text.remove_prefix(sent);
+        }
+
+        return true;
+    }
+
+    // a line without its end, false when the connection is closed
+    bool readLine(string& line)
+    {
+        while (true)
+        {
+            size_t end = buffer.find('\n', seek);
+            if (end != string::npos)
+            {
+                line.assign(buffer, seek, end - seek);
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                seek = end + 1;
+                return true;
+            }
+
+            if (!fill())
+                return false;
+        }
+    }
+
+    bool read(size_t n, string& text)
+    {
+        while (buffer.size() - seek < n)
+        {
+            if (!fill())
+                return false;
+        }
+
+        text.assign(buffer, seek, n);
+        seek += n;
+        return true;
+    }
+
+private:
+    bool fill()
+    {
+        buffer.erase(0, seek);
+        seek = 0;
+
+        char chunk[4096];
+#ifdef _WIN32
+        int received = ::recv(socket_handle, chunk, sizeof(chunk), 0);
+#else
+        ssize_t received = ::recv(socket_handle, chunk, sizeof(chunk), 0);
+#endif
+        if (received <= 0)
+            return false;
+
+        buffer.append(chunk, received);
+        return true;
+    }
+
+    static handle open(const string& path)
+    {
+#ifdef _WIN32
+        static bool started = [] { WSADATA data; return WSAStartup(MAKEWORD(2, 2), &data) == 0; }();
+        if (!started)
+            return invalid;
+#endif
+        if (path.size() >= sizeof(sockaddr_un::sun_path))
+            return invalid;
+
+        return ::socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+
+    static sockaddr_un addressOf(const string& path)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, path.data(), path.size());
+        return address;
+    }
+};
+
+template<class number, class VariableSet, class Parser = BasicTinyBasic<number, VariableSet>> class BasicServer
+{
+public:
+    typedef BasicVirtualMachine<number, VariableSet> VirtualMachine;
+    typedef typename VirtualMachine::Program Program;
+    typedef typename VirtualMachine::Verified Verified;
+
+    static constexpr size_t max_source = 1 << 20;
+
+private:
+    string path;
+    size_t slice;
+    size_t capacity;
+    size_t elements; // array elements a run can DIM, all its arrays together
+
+    // compiled programs by digest of their source, the oldest one is dropped when there are too many
+    struct Compiled
+    {
+        string source;
+        Verified program; // loaded by every run without being verified again
+    };
+
+    mutex cache_lock;
+    map<string, Compiled> cache;
+    deque<string> cache_order;
+
+    // machines allocated once, a run waits for a free one
+    mutex pool_lock;
+    condition_variable pool_free;
+    vector<unique_ptr<VirtualMachine>> machines;
+    vector<VirtualMachine*> idle;
+
+    // the connection is closed when the client is joined, so that its handle is not reused while it can be shut down
+    struct Client
+    {
+        unique_ptr<LocalConnection> connection;
+        thread worker;
+        atomic<bool> done{ false };
+    };
+
+    mutex clients_lock;
+    list<Client> clients;
+
+    LocalConnection::handle listener;
+    thread acceptor;
+    atomic<bool> stopping{ false };
+
+public:
+    // listens on path at once, throws when the socket cannot be created
+    BasicServer(const string& path, size_t pool = thread::hardware_concurrency(), size_t slice = 4096, size_t capacity = 1024, size_t elements = (size_t)1 << 22)
+        : path(path), slice(slice), capacity(capacity), elements(elements)
+    {
+        if (pool == 0)
+            pool = 1;
+
+        for (size_t i = 0; i < pool; i++)
+        {
+            machines.push_back(make_unique<VirtualMachine>());
+            idle.push_back(machines.back().get());
+        }
+
+        listener = LocalConnection::listen(path);
+        if (listener == LocalConnection::invalid)
+            throw runtime_error("cannot listen on " + path);
+
+        acceptor = thread(&BasicServer::accept, this);
+    }
+
+    ~BasicServer()
+    {
+        stopping = true;
+
+        LocalConnection::shutdown(listener);
+        acceptor.join();
+        LocalConnection::close(listener);
+
+        {
+            lock_guard<mutex> guard(pool_lock);
+        }
+        pool_free.notify_all();
+
+        lock_guard<mutex> guard(clients_lock);
+        for (Client& client : clients)
+            client.connection->interrupt();
+        for (Client& client : clients)
+            client.worker.join();
+
+        remove(path.c_str());
+    }
+
+    size_t programs()
+    {
+        lock_guard<mutex> guard(cache_lock);
+        return cache.size();
+    }
+
+private:
+    void accept()
+    {
+        while (!stopping)
+        {
+            LocalConnection::handle h = ::accept(listener, nullptr, nullptr);
+            if (h == LocalConnection::invalid)
+            {
+                if (stopping)
+                    return;
+                continue;
+            }
+
+            lock_guard<mutex> guard(clients_lock);
+
+            // threads of closed connections are joined here rather than left to the destructor
+            for (auto c = clients.begin(); c != clients.end();)
+            {
+                if (c->done)
+                {
+                    c->worker.join();
+                    c = clients.erase(c);
+                }
+                else
+                    c++;
+            }
+
+            clients.emplace_back();
+            Client& client = clients.back();
+            client.connection = make_unique<LocalConnection>(h);
+            client.worker = thread(&BasicServer::serve, this, &client);
+        }
+    }
+
+    void serve(Client* client)
+    {
+        LocalConnection& connection = *client->connection;
+
+        string line;
+        while (!stopping && connection.readLine(line))
+        {
+            istringstream words(line);
+            string command;
+            words >> command;
+
+            if (command == "PROGRAM")
+            {
+                size_t bytes;
+                string source;
+                if (!(words >> bytes) || bytes > max_source || !connection.read(bytes, source))
+                    break;
+
+                if (!connection.write(submit(source)))
+                    break;
+            }
+            else if (command == "RUN")
+            {
+                if (!run(connection, words))
+                    break;
+            }
+            else if (command == "QUIT")
+                break;
+            else if (!connection.write("ERROR unknown command\n"))
+                break;
+        }
+
+        client->done = true;
+    }
+
+    // SHA-256 in hexadecimal, the id of a program : a client cannot make another source with the id of a program it does not own
+    static string digest(const string& source)
+    {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+        // the source, a 1 bit, zeros up to 8 bytes before a multiple of 64, then its length in bits
+        string message = source;
+        message += (char)0x80;
+        while (message.size() % 64 != 56)
+            message += (char)0;
+        uint64_t bits = (uint64_t)source.size() * 8;
+        for (int i = 7; i >= 0; i--)
+            message += (char)(bits >> (i * 8));
+
+        auto rotate = [](uint32_t x, int n) { return (x >> n) | (x << (32 - n)); };
+
+        for (size_t block = 0; block < message.size(); block += 64)
+        {
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++)
+            {
+                const uint8_t* b = (const uint8_t*)message.data() + block + i * 4;
+                w[i] = (uint32_t)b[0] << 24 | (uint32_t)b[1] << 16 | (uint32_t)b[2] << 8 | b[3];
+            }
+            for (int i = 16; i < 64; i++)
+            {
+                uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+
+            uint32_t v[8];
+            copy(h, h + 8, v);
+            for (int i = 0; i < 64; i++)
+            {
+                uint32_t s1 = rotate(v[4], 6) ^ rotate(v[4], 11) ^ rotate(v[4], 25);
+                uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+                uint32_t t1 = v[7] + s1 + choice + k[i] + w[i];
+                uint32_t s0 = rotate(v[0], 2) ^ rotate(v[0], 13) ^ rotate(v[0], 22);
+                uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+                uint32_t t2 = s0 + majority;
+
+                copy_backward(v, v + 7, v + 8);
+                v[4] += t1;
+                v[0] = t1 + t2;
+            }
+            for (int i = 0; i < 8; i++)
+                h[i] += v[i];
+        }
+
+        char text[65];
+        for (int i = 0; i < 8; i++)
+            snprintf(text + i * 8, 9, "%08x", h[i]);
+        return text;
+    }
+
+    // an id is never given to another source, a digest that collides is refused
+    string submit(const string& source)
+    {
+        string id = digest(source);
+
+        auto cached = [&]() -> const char*
+        {
+            auto found = cache.find(id);
+            if (found == cache.end())
+                return nullptr;
+            return found->second.source == source ? "PROGRAM " : "ERROR program id already taken ";
+        };
+
+        {
+            lock_guard<mutex> guard(cache_lock);
+            if (const char* reply = cached())
+                return reply + id + "\n";
+        }
+
+        string error;
+        optional<Verified> program = compile(source, error);
+        if (!program)
+            return "ERROR " + error + "\n";
+
+        lock_guard<mutex> guard(cache_lock);
+
+        // another connection may have submitted it meanwhile
+        if (const char* reply = cached())
+            return reply + id + "\n";
+
+        cache_order.push_back(id);
+        cache.emplace(id, Compiled{ source, *program });
+
+        while (cache.size() > capacity)
+        {
+            cache.erase(cache_order.front());
+            cache_order.pop_front();
+        }
+
+        return "PROGRAM " + id + "\n";
+    }
+
+    // only numbered lines are accepted, a line without number would be run by the parser at once
+    static optional<Verified> compile(const string& source, string& error)
+    {
+        Parser parser;
+
+        istringstream lines(source);
+        string line;
+        for (size_t n = 1; getline(lines, line); n++)
+        {
+            if (!line.empty() && line.back() == '\r')
+                line.pop_back();
+            if (line.find_first_not_of(" \t") == string::npos)
+                continue;
+
+            if (line[0] < '0' || line[0] > '9')
+            {
+                error = "line " + to_string(n) + " of the source has no number";
+                return nullopt;
+            }
+
+            parser.parseLine(line);
+        }
+
+        Verified program = VirtualMachine::verified(parser.compile());
+
+        const vector<LoadError>& errors = program.errors();
+        if (!errors.empty())
+        {
+            error = "line " + to_string(errors[0].line) + ": " + errors[0].message;
+            return nullopt;
+        }
+
+        return program;
+    }
+
+    VirtualMachine* borrow()
+    {
+        unique_lock<mutex> guard(pool_lock);
+        pool_free.wait(guard, [this] { return stopping || !idle.empty(); });
+
+        if (stopping)
+            return nullptr;
+
+        VirtualMachine* vm = idle.back();
+        idle.pop_back();
+        return vm;
+    }
+
+    void giveBack(VirtualMachine* vm)
+    {
+        {
+            lock_guard<mutex> guard(pool_lock);
+            idle.push_back(vm);
+        }
+        pool_free.notify_one();
+    }
+
+    // false when the connection is lost
+    bool run(LocalConnection& connection, istringstream& words)
+    {
+        string name;
+        size_t budget;
+        uint64_t milliseconds;
+        if (!(words >> name >> budget >> milliseconds))
+            return connection.write("ERROR RUN needs a program, instructions and milliseconds\n");
+
+        deque<number> inputs;
+        number value;
+        while (words >> value)
+            inputs.push_back(value);
+
+        optional<Verified> program;
+        {
+            lock_guard<mutex> guard(cache_lock);
+
+            auto found = cache.find(name);
+            if (found != cache.end())
+                program = found->second.program;
+        }
+
+        if (!program)
+            return connection.write("ERROR unknown program " + name + "\n");
+
+        VirtualMachine* vm = borrow();
+        if (!vm)
+            return false;
+
+        // a machine of the pool keeps nothing from the previous run
+        fill(begin(vm->variables), end(vm->variables), (number)0);
+        vm->arrays.clear();
+
+        ostringstream printed;
+        vm->redirect(printed);
+        vm->limitArrays(elements);
+        vm->load(*program);
+        for (number input : inputs)
+            vm->input(input);
+
+        chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::milliseconds(milliseconds);
+
+        bool connected = true;
+        bool late = false;
+        status s;
+        do
+        {
+            s = vm->step(min(slice, budget - vm->instructionsExecuted()));
+
+            string text = printed.str();
+            if (!text.empty())
+            {
+                connected = connection.write("OUTPUT " + to_string(text.size()) + "\n") && connection.write(text);
+                printed.str(string());
+            }
+
+            late = s == status::exhausted && chrono::steady_clock::now() >= deadline;
+        }
+        while (connected && !late && s == status::exhausted && vm->instructionsExecuted() < budget);
+
+        string reply;
+        for (size_t i = 0; i < VariableSet::size; i++)
+        {
+            if (vm->variables[i] != 0)
+            {
+                char text[32];
+                to_chars_result result = to_chars(text, text + sizeof(text), vm->variables[i]);
+                reply += "VARIABLE " + to_string(i) + " " + string(text, result.ptr) + "\n";
+            }
+        }
+
+        static const char* names[] = { "finished", "exhausted", "waiting", "error", "blocked" };
+        reply += "DONE ";
+        reply += late ? "timeout" : names[(size_t)s];
+        reply += " " + to_string(vm->instructionsExecuted());
+        if (s == status::error)
+            reply += " " + vm->error();
+        reply += "\n";
+
+        vm->redirect(cout);
+        giveBack(vm);
+
+        return connected && connection.write(reply);
+    }
+};
+
+// a client of the server that runs one request at a time
+class ServerClient
+{
+    unique_ptr<LocalConnection> connection;
+
+public:
+    explicit ServerClient(const string& path) : connection(LocalConnection::connect(path)) {}
+
+    // id of the compiled program, throws with the message of the server when it is rejected
+    string submit(const string& source)
+    {
+        string reply;
+        if (!connection->write("PROGRAM " + to_string(source.size()) + "\n") || !connection->write(source) || !connection->readLine(reply))
+            throw runtime_error("connection lost");
+
+        if (reply.compare(0, 8, "PROGRAM ") != 0)
+            throw runtime_error(reply);
+
+        return reply.substr(8);
+    }
+
+    // the DONE line of the run, output receives what the program printed and the VARIABLE lines
+    string run(const string& id, size_t instructions, size_t milliseconds, const string& inputs, string& output)
+    {
+        string request = "RUN " + id + " " + to_string(instructions) + " " + to_string(milliseconds);
+        if (!inputs.empty())
+            request += " " + inputs;
+
+        if (!connection->write(request + "\n"))
+            throw runtime_error("connection lost");
+
+        output.clear();
+
+        string line;
+        while (connection->readLine(line))
+        {
+            if (line.compare(0, 7, "OUTPUT ") == 0)
+            {
+                string text;
+                if (!connection->read(stoull(line.substr(7)), text))
+                    break;
+                output += text;
+            }
+            else if (line.compare(0, 9, "VARIABLE ") == 0)
+                output += line + "\n";
+            else if (line.compare(0, 5, "DONE ") == 0)
+                return line;
+            else
+                throw runtime_error(line);
+        }
+
+        throw runtime_error("connection lost");
+    }
+};
+
+// result of generateLoad, latencies are in milliseconds
+struct LoadReport
+{
+    size_t requests = 0;
+    size_t failures = 0;
+    double seconds = 0;
+    double requests_per_second = 0;
+    double p50 = 0;
+    double p99 = 0;
+
+    string summary() const
+    {
+        char text[256];
+        snprintf(text, sizeof(text), "%zu requests, %zu failed, %.0f req/s, p50 %.3f ms, p99 %.3f ms", requests, failures, requests_per_second, p50, p99);
+        return text;
+    }
+};
+
+// clients threads each submit source once then run it requests times on its own connection
+inline LoadReport generateLoad(const string& path, const string& source, size_t threads, size_t requests, size_t instructions = 1000000, size_t milliseconds = 1000)
+{
+    vector<vector<double>> latencies(threads);
+    vector<size_t> failures(threads);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    vector<thread> clients;
+    for (size_t t = 0; t < threads; t++)
+    {
+        clients.emplace_back([&, t]
+        {
+            try
+            {
+                ServerClient client(path);
+                string id = client.submit(source);
+
+                string output;
+                for (size_t r = 0; r < requests; r++)
+                {
+                    chrono::steady_clock::time_point sent = chrono::steady_clock::now();
+                    string done = client.run(id, instructions, milliseconds, "", output);
+                    latencies[t].push_back(chrono::duration<double, milli>(chrono::steady_clock::now() - sent).count());
+
+                    if (done.compare(0, 14, "DONE finished ") != 0)
+                        failures[t]++;
+                }
+            }
+            catch (const exception&)
+            {
+                failures[t] += requests - latencies[t].size();
+            }
+        });
+    }
+
+    for (thread& client : clients)
+        client.join();
+
+    LoadReport report;
+    report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<double> all;
+    for (size_t t = 0; t < threads; t++)
+    {
+        all.insert(all.end(), latencies[t].begin(), latencies[t].end());
+        report.failures += failures[t];
+    }
+
+    report.requests = all.size();
+    if (report.seconds > 0)
+        report.requests_per_second = report.requests / report.seconds;
+
+    if (!all.empty())
+    {
+        sort(all.begin(), all.end());
+        report.p50 = all[(all.size() - 1) / 2];
+        report.p99 = all[(size_t)ceil(all.size() * 0.99) - 1];
+    }
+
+    return report;
+}
+
+typedef BasicServer<number, Variables> Server;
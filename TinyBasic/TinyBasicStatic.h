@@ -0,0 +1,765 @@
+#pragma once
+
+// Tiny BASIC programs compiled by the C++ compiler
+// https://github.com/Kibisoft/TinyBasic
+//
+// MIT License, see TinyBasic.h
+//
+// A program written as a string literal is parsed by a constexpr parser
+// into the same bytecode as BasicTinyBasic produces, stored in a constant
+// image. When the image is declared constexpr a syntax error is a compile
+// error, and the program needs no parsing when the service starts :
+//
+//     static constexpr auto program = StaticTinyBasic::compile(
+//         "10 FOR I=1 TO 10\n"
+//         "20 LET S=S+I\n"
+//         "30 NEXT I\n");
+//
+//     vm.load(program.program());
+//
+// The statements are those of BasicTinyBasic that do not depend on the
+// running process : LET, PRINT, INPUT, IF, GOTO, GOSUB, RETURN, END, FOR,
+// NEXT, DIM, SEND and RECV. Commands, host functions, MAT and PARALLEL are
+// left to the runtime parser. The numbers of the image are written in the
+// byte order of little endian targets.
+
+#include "TinyBasic.h"
+
+#include <array>
+#include <limits>
+
+// a compiled program : the bytecode of every line in a constant image, the lines sorted by number
+// the capacity follows the length N of the source text, a character never gives more than 2 + sizeof(number) bytes
+template<class number, class VariableSet, size_t N> struct BasicStaticProgram
+{
+    typedef BasicVirtualMachine<number, VariableSet> VirtualMachine;
+    typedef typename VirtualMachine::Program Program;
+    typedef BasicInstructionSet<number> InstructionSet;
+
+    struct Line
+    {
+        size_t label = 0;
+        size_t start = 0;
+        size_t size = 0;
+    };
+
+    array<uint8_t, N * (2 + sizeof(number))> code {};
+    size_t code_size = 0;
+
+    array<Line, N / 4 + 1> lines {};
+    size_t line_count = 0;
+
+    // the program a machine runs, the bytes are copied line by line
+    shared_ptr<const Program> program() const
+    {
+        shared_ptr<Program> program = make_shared<Program>();
+
+        for (size_t l = 0; l < line_count; l++)
+            (*program)[lines[l].label] = InstructionSet::bytes(code.data() + lines[l].start, lines[l].size);
+
+        return program;
+    }
+};
+
+template<class number, class VariableSet, size_t N> class BasicStaticParser
+{
+public:
+    typedef BasicStaticProgram<number, VariableSet, N> StaticProgram;
+
+    StaticProgram result {};
+
+private:
+    // a FOR or a NEXT, paired once every line is known
+    struct Loop
+    {
+        size_t at = 0; // the word of a FOR, the opcode of a NEXT
+        size_t variable = 0;
+        bool next = false;
+    };
+
+    string_view text;
+    string_view line;
+    size_t seek = 0;
+
+    array<Loop, N / 4 + 1> loops {};
+    size_t loop_count = 0;
+
+    array<string_view, VariableSet::size> variables {};
+    size_t variable_count = 0;
+
+    array<string_view, N / 2 + 1> arrays {};
+    size_t array_count = 0;
+
+    size_t jump_sites = 0;
+
+public:
+    constexpr BasicStaticParser(string_view text) : text(text) {}
+
+    constexpr void parseProgram()
+    {
+        size_t at = 0;
+        while (at < text.size())
+        {
+            size_t end = text.find('\n', at);
+            if (end == string_view::npos)
+                end = text.size();
+
+            line = text.substr(at, end - at);
+            if (!line.empty() && line.back() == '\r')
+                line.remove_suffix(1);
+            at = end + 1;
+
+            seek = 0;
+            eatBlank();
+            if (eol())
+                continue;
+
+            parseLine();
+        }
+
+        resolveLoops();
+    }
+
+private:
+    static constexpr bool expect(bool condition, const char* message)
+    {
+        if (!condition)
+            throw invalid_argument(message);
+        return true;
+    }
+
+    constexpr bool eol() const { return seek >= line.size(); }
+
+    constexpr void eatBlank()
+    {
+        while (!eol() && (line[seek] == ' ' || line[seek] == '\t'))
+            seek++;
+    }
+
+    constexpr bool parse(char c)
+    {
+        if (eol() || line[seek] != c)
+            return false;
+
+        seek++;
+        return true;
+    }
+
+    constexpr bool parse(string_view word)
+    {
+        if (line.substr(seek, word.size()) != word)
+            return false;
+
+        seek += word.size();
+        eatBlank();
+        return true;
+    }
+
+    constexpr bool letter() const { return !eol() && line[seek] >= 'A' && line[seek] <= 'Z'; }
+    constexpr bool digit() const { return !eol() && line[seek] >= '0' && line[seek] <= '9'; }
+
+    // code of the line being parsed, always at the end of the image
+
+    constexpr void emit(uint8_t byte)
+    {
+        expect(result.code_size < result.code.size(), "static program too large");
+        result.code[result.code_size++] = byte;
+    }
+
+    constexpr void emit(instruction op) { emit((uint8_t)op); }
+
+    constexpr void emitVarint(size_t value)
+    {
+        for (; value >= 0x80; value >>= 7)
+            emit((uint8_t)(value | 0x80));
+        emit((uint8_t)value);
+    }
+
+    constexpr void emitWord(size_t value)
+    {
+        for (size_t b = 0; b < sizeof(size_t); b++, value >>= 8)
+            emit((uint8_t)value);
+    }
+
+    // the bytes of an integer literal as the number type stores it
+    constexpr void emitNumber(uint64_t value)
+    {
+        uint64_t bits = value;
+
+        if constexpr (!is_integral_v<number>)
+        {
+            static_assert(numeric_limits<number>::is_iec559 && (sizeof(number) == 4 || sizeof(number) == 8), "static programs need IEEE float or double");
+
+            constexpr int mantissa = numeric_limits<number>::digits - 1;
+            constexpr int bias = numeric_limits<number>::max_exponent - 1;
+
+            expect(value < ((uint64_t)1 << numeric_limits<number>::digits), "number too large for a static program");
+
+            if (value != 0)
+            {
+                int exponent = 0;
+                while ((value >> exponent) > 1)
+                    exponent++;
+
+                bits = ((uint64_t)(exponent + bias) << mantissa) | ((value << (mantissa - exponent)) & (((uint64_t)1 << mantissa) - 1));
+            }
+        }
+        else
+            expect(value <= (uint64_t)(numeric_limits<number>::max)(), "number too large for a static program");
+
+        for (size_t b = 0; b < sizeof(number); b++, bits >>= 8)
+            emit((uint8_t)bits);
+    }
+
+    // room for n bytes at a position of the current line, the code after it moves
+    constexpr void open(size_t at, size_t n)
+    {
+        expect(result.code_size + n <= result.code.size(), "static program too large");
+
+        for (size_t i = result.code_size; i > at; i--)
+            result.code[i - 1 + n] = result.code[i - 1];
+        result.code_size += n;
+
+        for (size_t l = 0; l < loop_count; l++)
+        {
+            if (loops[l].at >= at)
+                loops[l].at += n;
+        }
+    }
+
+    constexpr void insert(size_t at, instruction op)
+    {
+        open(at, 1);
+        result.code[at] = (uint8_t)op;
+    }
+
+    constexpr void parseLine()
+    {
+        expect(digit(), "a line of a static program starts with its number");
+
+        uint64_t label = parseNumber();
+        size_t start = result.code_size;
+
+        parseStatement();
+
+        eatBlank();
+        expect(eol(), "unexpected characters after the statement");
+
+        addLine((size_t)label, start, result.code_size - start);
+    }
+
+    // a line given again replaces the first one, as with BasicTinyBasic::parseLine
+    constexpr void addLine(size_t label, size_t start, size_t size)
+    {
+        auto& lines = result.lines;
+        size_t& count = result.line_count;
+
+        size_t l = 0;
+        while (l < count && lines[l].label < label)
+            l++;
+
+        if (l == count || lines[l].label != label)
+        {
+            expect(count < lines.size(), "too many lines in a static program");
+
+            for (size_t i = count; i > l; i--)
+                lines[i] = lines[i - 1];
+            count++;
+        }
+
+        lines[l].label = label;
+        lines[l].start = start;
+        lines[l].size = size;
+    }
+
+    constexpr uint64_t parseNumber()
+    {
+        uint64_t value = 0;
+        while (digit())
+        {
+            expect(value <= ((numeric_limits<uint64_t>::max)() - 9) / 10, "number too large for a static program");
+            value = value * 10 + (uint64_t)(line[seek] - '0');
+            seek++;
+        }
+
+        eatBlank();
+        return value;
+    }
+
+    constexpr void parseStatement()
+    {
+        size_t i = seek;
+        while (letter())
+            seek++;
+
+        string_view keyword = line.substr(i, seek - i);
+        eatBlank();
+
+        if (keyword == "LET")
+            parseLet();
+        else if (keyword == "PRINT")
+            parsePrint();
+        else if (keyword == "INPUT")
+            parseInput();
+        else if (keyword == "IF")
+            parseIf();
+        else if (keyword == "GOTO")
+            parseJump(instruction::got);
+        else if (keyword == "GOSUB")
+            parseJump(instruction::gosub);
+        else if (keyword == "RETURN")
+            emit(instruction::ret);
+        else if (keyword == "END")
+            emit(instruction::end);
+        else if (keyword == "FOR")
+            parseFor();
+        else if (keyword == "NEXT")
+            parseNext();
+        else if (keyword == "DIM")
+            parseDim();
+        else if (keyword == "SEND")
+            parseSend();
+        else if (keyword == "RECV")
+            parseRecv();
+        else
+            expect(false, "unknown statement in a static program");
+    }
+
+    constexpr void parseLet()
+    {
+        if (size_t array = 0; parseArray(array))
+        {
+            emit(instruction::setarr);
+            emitVarint(array);
+            parseIndex();
+        }
+        else
+        {
+            emit(instruction::setvar);
+            emitVarint(parseVariable());
+        }
+
+        expect(parse('='), "expected =");
+        eatBlank();
+
+        parseExpression();
+    }
+
+    constexpr void parsePrint()
+    {
+        if (eol())
+        {
+            emit(instruction::print_end);
+            emitVarint(1);
+            return;
+        }
+
+        while (true)
+        {
+            size_t item = result.code_size;
+
+            if (!eol() && line[seek] == '"')
+            {
+                size_t end = line.find('"', seek + 1);
+                expect(end != string_view::npos, "unterminated string");
+
+                emit(instruction::print_string);
+                emitVarint(end - seek - 1);
+                for (size_t c = seek + 1; c < end; c++)
+                    emit((uint8_t)line[c]);
+                seek = end + 1;
+            }
+            else
+            {
+                emit(instruction::print_value);
+                parseExpression();
+            }
+
+            eatBlank();
+            if (eol())
+            {
+                // a single value and its newline is a single instruction
+                if (result.code[item] == (uint8_t)instruction::print_value)
+                    result.code[item] = (uint8_t)instruction::print;
+                else
+                {
+                    emit(instruction::print_end);
+                    emitVarint(1);
+                }
+                return;
+            }
+
+            if (parse(','))
+                emit(instruction::print_tab);
+            else
+                expect(parse(';'), "expected , or ; between the items of PRINT");
+
+            eatBlank();
+            if (eol())
+            {
+                emit(instruction::print_end);
+                emitVarint(0);
+                return;
+            }
+        }
+    }
+
+    constexpr void parseInput()
+    {
+        do
+        {
+            eatBlank();
+
+            emit(instruction::input);
+            emitVarint(parseVariable());
+        }
+        while (parse(','));
+    }
+
+    constexpr void parseIf()
+    {
+        size_t start = result.code_size;
+
+        parseExpression();
+        instruction op = parseRelop();
+        insert(start, op);
+        parseExpression();
+
+        expect(parse("THEN"), "expected THEN");
+
+        emit(instruction::jne);
+        size_t statement = result.code_size;
+        parseStatement();
+
+        // the size of the statement comes before it
+        size_t size = result.code_size - statement;
+        size_t length = 1;
+        for (size_t v = size; v >= 0x80; v >>= 7)
+            length++;
+
+        open(statement, length);
+        for (size_t b = 0; b < length; b++, size >>= 7)
+            result.code[statement + b] = (uint8_t)(b + 1 < length ? (size & 0x7f) | 0x80 : size);
+    }
+
+    constexpr void parseJump(instruction op)
+    {
+        emit(op);
+        emitVarint(jump_sites++);
+        parseExpression();
+    }
+
+    constexpr void parseFor()
+    {
+        emit(instruction::forloop);
+        size_t variable = parseVariable();
+        emitVarint(variable);
+
+        // the line of the matching NEXT is written by resolveLoops()
+        expect(loop_count < loops.size(), "too many loops in a static program");
+        loops[loop_count++] = { result.code_size, variable, false };
+        emitWord(0);
+
+        expect(parse('='), "expected =");
+        eatBlank();
+        parseExpression();
+
+        expect(parse("TO"), "expected TO");
+        parseExpression();
+
+        if (parse("STEP"))
+            parseExpression();
+        else
+        {
+            emit(instruction::push);
+            emitNumber(1);
+        }
+    }
+
+    constexpr void parseNext()
+    {
+        size_t variable = letter() ? parseVariable() : (size_t)-1;
+
+        expect(loop_count < loops.size(), "too many loops in a static program");
+        loops[loop_count++] = { result.code_size, variable, true };
+
+        emit(instruction::next);
+        emitVarint(variable);
+    }
+
+    constexpr void parseDim()
+    {
+        do
+        {
+            eatBlank();
+
+            size_t array = 0;
+            expect(parseArray(array), "expected an array");
+
+            emit(instruction::dim);
+            emitVarint(array);
+            parseIndex();
+        }
+        while (parse(','));
+    }
+
+    constexpr void parseSend()
+    {
+        emit(instruction::send);
+        parseExpression();
+
+        expect(parse(','), "expected ,");
+        eatBlank();
+
+        parseExpression();
+    }
+
+    constexpr void parseRecv()
+    {
+        size_t start = result.code_size;
+        parseExpression();
+
+        expect(parse(','), "expected ,");
+        eatBlank();
+
+        // the variable comes before the channel
+        size_t variable = parseVariable();
+        size_t length = 1;
+        for (size_t v = variable; v >= 0x80; v >>= 7)
+            length++;
+
+        open(start, 1 + length);
+        result.code[start] = (uint8_t)instruction::recv;
+        for (size_t b = 0; b < length; b++, variable >>= 7)
+            result.code[start + 1 + b] = (uint8_t)(b + 1 < length ? (variable & 0x7f) | 0x80 : variable);
+    }
+
+    constexpr void parseExpression()
+    {
+        size_t start = result.code_size;
+
+        bool negate = false;
+        if (parse('-'))
+            negate = true;
+        else
+            parse('+');
+        eatBlank();
+
+        parseTerm();
+
+        if (negate)
+        {
+            // 0 - term, zero has no bits set in every number type
+            open(start, 2 + sizeof(number));
+            result.code[start] = (uint8_t)instruction::minus;
+            result.code[start + 1] = (uint8_t)instruction::push;
+            for (size_t b = 0; b < sizeof(number); b++)
+                result.code[start + 2 + b] = 0;
+        }
+
+        while (true)
+        {
+            if (parse('+'))
+                insert(start, instruction::plus);
+            else if (parse('-'))
+                insert(start, instruction::minus);
+            else
+                return;
+
+            eatBlank();
+            parseTerm();
+        }
+    }
+
+    constexpr void parseTerm()
+    {
+        size_t start = result.code_size;
+
+        parseFactor();
+
+        while (true)
+        {
+            if (parse('*'))
+                insert(start, instruction::mult);
+            else if (parse('/'))
+                insert(start, instruction::div);
+            else
+                return;
+
+            eatBlank();
+            parseFactor();
+        }
+    }
+
+    constexpr void parseFactor()
+    {
+        if (digit())
+        {
+            emit(instruction::push);
+            emitNumber(parseNumber());
+        }
+        else if (size_t array = 0; parseArray(array))
+        {
+            emit(instruction::getarr);
+            emitVarint(array);
+            parseIndex();
+        }
+        else if (letter())
+        {
+            emit(instruction::getvar);
+            emitVarint(parseVariable());
+        }
+        else
+        {
+            expect(parse('('), "expected a number, a variable or (");
+            eatBlank();
+
+            parseExpression();
+
+            expect(parse(')'), "expected )");
+            eatBlank();
+        }
+    }
+
+    constexpr instruction parseRelop()
+    {
+        instruction op = instruction::nop;
+
+        if (parse('='))
+            op = instruction::eq;
+        else if (parse('>'))
+            op = parse('=') ? instruction::ge : instruction::gt;
+        else if (parse('<'))
+            op = parse('=') ? instruction::le : parse('>') ? instruction::ne : instruction::lt;
+        else
+            expect(false, "expected a comparison");
+
+        eatBlank();
+        return op;
+    }
+
+    constexpr string_view parseName()
+    {
+        size_t i = seek;
+
+        seek++;
+        if constexpr (VariableSet::long_names)
+        {
+            while (letter())
+                seek++;
+        }
+
+        return line.substr(i, seek - i);
+    }
+
+    // variables and arrays are numbered in the order they first appear, as BasicTinyBasic does
+    constexpr size_t parseVariable()
+    {
+        expect(letter(), "expected a variable");
+
+        string_view name = parseName();
+        eatBlank();
+
+        if constexpr (!VariableSet::long_names)
+            return (size_t)(name[0] - 'A');
+
+        for (size_t v = 0; v < variable_count; v++)
+        {
+            if (variables[v] == name)
+                return v;
+        }
+
+        expect(variable_count < variables.size(), "too many variables");
+        variables[variable_count] = name;
+        return variable_count++;
+    }
+
+    // a name directly followed by a parenthesis
+    constexpr bool parseArray(size_t& slot)
+    {
+        if (!letter())
+            return false;
+
+        size_t i = seek;
+        string_view name = parseName();
+        eatBlank();
+
+        if (eol() || line[seek] != '(')
+        {
+            seek = i;
+            return false;
+        }
+
+        expect(name != "SUM" && name != "DOT", "MAT functions are not available in a static program");
+
+        for (slot = 0; slot < array_count; slot++)
+        {
+            if (arrays[slot] == name)
+                return true;
+        }
+
+        arrays[array_count++] = name;
+        return true;
+    }
+
+    constexpr void parseIndex()
+    {
+        expect(parse('('), "expected (");
+        eatBlank();
+
+        parseExpression();
+
+        expect(parse(')'), "expected )");
+        eatBlank();
+    }
+
+    // pairs each FOR with the NEXT that closes it, in the order of the lines, see BasicTinyBasic::resolveLoops
+    constexpr void resolveLoops()
+    {
+        array<size_t, N / 4 + 1> open {}; // the loops still open
+        size_t depth = 0;
+
+        for (size_t l = 0; l < result.line_count; l++)
+        {
+            const auto& entry = result.lines[l];
+
+            for (size_t k = 0; k < loop_count; k++)
+            {
+                const Loop& loop = loops[k];
+                if (loop.at < entry.start || loop.at >= entry.start + entry.size)
+                    continue; // a line given again
+
+                if (!loop.next)
+                {
+                    open[depth++] = k;
+                    continue;
+                }
+
+                while (depth > 0 && loop.variable != (size_t)-1 && loops[open[depth - 1]].variable != loop.variable)
+                    depth--;
+
+                if (depth > 0)
+                {
+                    size_t value = entry.label;
+                    for (size_t b = 0; b < sizeof(size_t); b++, value >>= 8)
+                        result.code[loops[open[depth - 1]].at + b] = (uint8_t)value;
+                    depth--;
+                }
+            }
+        }
+    }
+};
+
+template<class number, class VariableSet> class BasicStaticTinyBasic
+{
+public:
+    // declared constexpr, a program with a syntax error does not compile
+    template<size_t N> static constexpr BasicStaticProgram<number, VariableSet, N> compile(const char(&text)[N])
+    {
+        BasicStaticParser<number, VariableSet, N> parser(string_view(text, N - 1));
+        parser.parseProgram();
+        return parser.result;
+    }
+};
+
+typedef BasicStaticTinyBasic<number, Variables> StaticTinyBasic;